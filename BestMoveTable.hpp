@@ -0,0 +1,87 @@
+// Copyright (C) 2016  Sami Liedes
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#ifndef BestMoveTable_hpp
+#define BestMoveTable_hpp
+
+#include "Pos.hpp"
+#include "TranspositionTable.hpp"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <memory>
+
+// The move that raised alpha or caused a cutoff the last time a
+// position was searched, so that a re-search (after a bound from the
+// transposition table was not enough, or after the entry was evicted)
+// can try it first.
+//
+// The 32-bit entries of TranspositionTableBase have no bits to spare,
+// and widening them to 64 bits would double the memory of the largest
+// structure of the search, so the moves live in a table of their own
+// with 16-bit entries: an 8-bit check of pos/CAPACITY and an 8-bit
+// move code. A false match only costs ordering, since the code is
+// looked up among the legal moves. Entries are single atomic words, so
+// threads may race on them freely.
+template<size_t CAPACITY>
+class BestMoveTable {
+    static constexpr int CODE_BITS = 8;
+    // from square and one of 4 kinds of move, + 1 so that 0 is empty
+    static_assert(NUM_ISQ*4 < (1 << CODE_BITS), "move code does not fit");
+
+    typedef std::array<std::atomic<uint16_t>, CAPACITY> Array;
+    std::unique_ptr<Array> tab;
+
+    static size_t hash(uint64_t pos) { return pos%CAPACITY; }
+    static uint16_t check(uint64_t pos) { return uint16_t(pos/CAPACITY) << CODE_BITS; }
+    BestMoveTable(const BestMoveTable &);
+public:
+    static constexpr size_t capacity = CAPACITY;
+    static constexpr uint64_t bytes = CAPACITY*sizeof(uint16_t);
+
+    BestMoveTable() : tab(std::make_unique<Array>()) {
+	for (auto &e : *tab)
+	    e.store(0, std::memory_order_relaxed);
+    }
+
+    // 0 is never returned
+    static int move_code(const Pos::Move &m) {
+	int kind;
+	switch (std::abs(m.to - m.from)) {
+	case N: kind = 0; break;
+	case 2*N: kind = 1; break;
+	case N-1: kind = 2; break;
+	default: kind = 3; break; // N+1
+	}
+	return m.from*4 + kind + 1;
+    }
+
+    // The move code stored for pos, or 0.
+    TP_INLINE int probe(uint64_t pos) const {
+	const uint16_t e = (*tab)[hash(pos)].load(std::memory_order_relaxed);
+	if ((e & ~((1 << CODE_BITS) - 1)) != check(pos))
+	    return 0;
+	return e & ((1 << CODE_BITS) - 1);
+    }
+
+    TP_INLINE void add(uint64_t pos, const Pos::Move &m) {
+	(*tab)[hash(pos)].store(check(pos) | move_code(m), std::memory_order_relaxed);
+    }
+};
+
+#endif
@@ -0,0 +1,158 @@
+// Copyright (C) 2016  Sami Liedes
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#ifndef CachedTranspositionTable_hpp
+#define CachedTranspositionTable_hpp
+
+#include "ThreadSlot.hpp"
+#include "TranspositionTable.hpp"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+
+// Two-level table: every thread slot has its own small L1 table in
+// front of the big shared L2 table. Probes go to L1 first and L2 hits
+// are copied to L1; a bound found in L1 is merged with what L2 has,
+// which may be better if another thread got there first. Stores always go to L1, but only results of
+// subtrees of at least promote_min_nodes nodes are written through
+// to L2, so that the many tiny subtrees near the leaves do not
+// compete for memory bandwidth (promote_min_nodes = 0 gives a plain
+// write-through cache).
+template<class L1, class L2>
+class CachedTranspositionTable {
+public:
+    struct LevelStats {
+	uint64_t probes = 0;
+	uint64_t l1_hits = 0;
+	uint64_t l2_hits = 0;
+	uint64_t l1_stores = 0;
+	uint64_t l2_stores = 0;
+
+	uint64_t hits() const { return l1_hits + l2_hits; }
+	LevelStats &operator+=(const LevelStats &a) {
+	    probes += a.probes;
+	    l1_hits += a.l1_hits;
+	    l2_hits += a.l2_hits;
+	    l1_stores += a.l1_stores;
+	    l2_stores += a.l2_stores;
+	    return *this;
+	}
+	LevelStats operator-(const LevelStats &a) const {
+	    LevelStats st;
+	    st.probes = probes - a.probes;
+	    st.l1_hits = l1_hits - a.l1_hits;
+	    st.l2_hits = l2_hits - a.l2_hits;
+	    st.l1_stores = l1_stores - a.l1_stores;
+	    st.l2_stores = l2_stores - a.l2_stores;
+	    return st;
+	}
+    };
+private:
+    // Counters are only written by the slot owner, so a relaxed
+    // load+store is enough; atomics just make reading them safe.
+    struct alignas(64) Slot {
+	std::unique_ptr<L1> table;
+	std::atomic<uint64_t> probes{0}, l1_hits{0}, l2_hits{0}, l1_stores{0}, l2_stores{0};
+
+	LevelStats stats() const {
+	    LevelStats st;
+	    st.probes = probes.load(std::memory_order_relaxed);
+	    st.l1_hits = l1_hits.load(std::memory_order_relaxed);
+	    st.l2_hits = l2_hits.load(std::memory_order_relaxed);
+	    st.l1_stores = l1_stores.load(std::memory_order_relaxed);
+	    st.l2_stores = l2_stores.load(std::memory_order_relaxed);
+	    return st;
+	}
+    };
+    std::array<Slot, MAX_THREAD_SLOTS> slots;
+    L2 l2;
+    const uint64_t promote_min_nodes;
+
+    static void bump(std::atomic<uint64_t> &c) {
+	c.store(c.load(std::memory_order_relaxed)+1, std::memory_order_relaxed);
+    }
+
+    TP_INLINE Slot &local() {
+	Slot &s = slots[thread_slot()];
+	if (!s.table)
+	    s.table = std::make_unique<L1>();
+	return s;
+    }
+    CachedTranspositionTable(const CachedTranspositionTable &);
+public:
+    CachedTranspositionTable(uint64_t promote_min_nodes)
+	: promote_min_nodes(promote_min_nodes) {}
+
+    TP_INLINE TpResult probe(uint64_t pos) {
+	Slot &s = local();
+	bump(s.probes);
+	TpResult res = s.table->probe(pos);
+	if (res != TpResult::NONE) {
+	    bump(s.l1_hits);
+	    // Another thread may have put an exact result or the other
+	    // bound in L2 since this bound was stored.
+	    if (res == TpResult::LOWER_BOUND_0 || res == TpResult::UPPER_BOUND_0) {
+		const TpResult merged = merge_results(res, l2.probe(pos));
+		if (merged != res) {
+		    s.table->add(pos, merged);
+		    res = merged;
+		}
+	    }
+	    return res;
+	}
+	res = l2.probe(pos);
+	if (res != TpResult::NONE) {
+	    bump(s.l2_hits);
+	    s.table->add(pos, res);
+	}
+	return res;
+    }
+
+    // subtree_nodes = number of nodes searched to find the result
+    TP_INLINE void add(uint64_t pos, TpResult result, uint64_t subtree_nodes) {
+	Slot &s = local();
+	s.table->add(pos, result);
+	bump(s.l1_stores);
+	if (subtree_nodes >= promote_min_nodes) {
+	    l2.add(pos, result);
+	    bump(s.l2_stores);
+	}
+    }
+
+    void add(uint64_t pos, TpResult result) { add(pos, result, UINT64_MAX); }
+
+    LevelStats level_stats() const {
+	LevelStats st;
+	for (const Slot &s : slots)
+	    st += s.stats();
+	return st;
+    }
+    LevelStats slot_level_stats(int slot) const { return slots[slot].stats(); }
+
+    L2 &shared() { return l2; }
+
+    // These only concern the shared table; L1 contents are transient.
+    TpTableStats stats() const { return l2.stats(); }
+    size_t size() const { return l2.size(); }
+    size_t get_capacity() const { return l2.get_capacity(); }
+    bool is_empty_slot(uint64_t pos) const { return l2.is_empty_slot(pos); }
+    void save(const char *fname) const { l2.save(fname); }
+    void load(const char *fname) { l2.load(fname); }
+};
+
+#endif
@@ -0,0 +1,122 @@
+// Copyright (C) 2016  Sami Liedes
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#include "ChunkedFile.hpp"
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <zlib.h>
+
+using std::cerr;
+using std::endl;
+using std::string;
+using std::vector;
+
+ChunkedWriter::ChunkedWriter(const string &fname, bool compress, int num_threads)
+    : fname(fname), fp(fopen(fname.c_str(), "wb")), compress(compress),
+      num_threads(compress ? num_threads : 1), chunks(this->num_threads)
+{
+    if (!fp) {
+	cerr << "Could not open " << fname << " for writing" << endl;
+	abort();
+    }
+    for (auto &c : chunks)
+	c.reserve(CHUNK_SIZE);
+}
+
+void ChunkedWriter::end_chunk() {
+    if (++num_full == chunks.size())
+	flush_chunks();
+}
+
+void ChunkedWriter::flush_chunks() {
+    vector<vector<uint8_t>> stored(num_full);
+    auto compress_chunk = [&](size_t i) {
+	uLongf len = compressBound(chunks[i].size());
+	stored[i].resize(len);
+	if (compress2(stored[i].data(), &len, chunks[i].data(), chunks[i].size(), 1) != Z_OK ||
+	    len >= chunks[i].size())
+	    stored[i].clear(); // store uncompressed
+	else
+	    stored[i].resize(len);
+    };
+    if (compress) {
+	vector<std::thread> threads;
+	for (size_t i=0; i<num_full; i++)
+	    threads.emplace_back(compress_chunk, i);
+	for (auto &t : threads)
+	    t.join();
+    }
+
+    for (size_t i=0; i<num_full; i++) {
+	const vector<uint8_t> &data = stored[i].empty() ? chunks[i] : stored[i];
+	ChunkHeader h;
+	h.raw_size = chunks[i].size();
+	h.stored_size = data.size();
+	if (fwrite(&h, sizeof(h), 1, fp) != 1 ||
+	    fwrite(data.data(), 1, data.size(), fp) != data.size()) {
+	    cerr << fname << ": short write" << endl;
+	    abort();
+	}
+	raw_bytes += h.raw_size;
+	stored_bytes += sizeof(h) + h.stored_size;
+	chunks[i].clear();
+    }
+    num_full = 0;
+}
+
+void ChunkedWriter::close() {
+    if (!fp)
+	return;
+    if (!chunks[num_full].empty())
+	num_full++;
+    flush_chunks();
+    if (fclose(fp) != 0) {
+	cerr << "Failed to close " << fname << endl;
+	abort();
+    }
+    fp = nullptr;
+}
+
+ChunkedReader::ChunkedReader(const string &fname)
+    : fname(fname), fp(fopen(fname.c_str(), "rb"))
+{
+    if (!fp) {
+	cerr << "Could not open " << fname << endl;
+	abort();
+    }
+}
+
+bool ChunkedReader::next_chunk() {
+    ChunkHeader h;
+    if (fread(&h, sizeof(h), 1, fp) != 1)
+	return false;
+    chunk.resize(h.raw_size);
+    pos = 0;
+    if (h.stored_size == h.raw_size) {
+	if (fread(chunk.data(), 1, h.raw_size, fp) == h.raw_size)
+	    return true;
+    } else {
+	stored.resize(h.stored_size);
+	uLongf len = h.raw_size;
+	if (fread(stored.data(), 1, h.stored_size, fp) == h.stored_size &&
+	    uncompress(chunk.data(), &len, stored.data(), h.stored_size) == Z_OK &&
+	    len == h.raw_size)
+	    return true;
+    }
+    cerr << fname << ": truncated or corrupt chunk" << endl;
+    abort();
+}
@@ -0,0 +1,136 @@
+// Copyright (C) 2016  Sami Liedes
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#ifndef ChunkedFile_hpp
+#define ChunkedFile_hpp
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+// Files that are only ever streamed sequentially, written in chunks of
+// CHUNK_SIZE bytes. Each chunk is a ChunkHeader followed by the data,
+// zlib-compressed if that was asked for and made it smaller. With
+// compression the writer compresses up to num_threads chunks in
+// parallel.
+struct ChunkHeader {
+    uint32_t raw_size, stored_size;
+};
+
+class ChunkedWriter {
+    const std::string fname;
+    FILE *fp;
+    const bool compress;
+    const int num_threads;
+    std::vector<std::vector<uint8_t>> chunks; // chunks[0] is being filled
+    size_t num_full = 0;
+    uint64_t raw_bytes = 0, stored_bytes = 0;
+
+    void end_chunk();
+    void flush_chunks();
+    ChunkedWriter(const ChunkedWriter &);
+public:
+    static constexpr size_t CHUNK_SIZE = 4 << 20;
+
+    ChunkedWriter(const std::string &fname, bool compress, int num_threads);
+    ~ChunkedWriter() { close(); }
+
+    void write(const void *data, size_t size) {
+	const uint8_t *p = static_cast<const uint8_t *>(data);
+	while (size > 0) {
+	    std::vector<uint8_t> &c = chunks[num_full];
+	    const size_t n = std::min(size, CHUNK_SIZE - c.size());
+	    c.insert(c.end(), p, p+n);
+	    p += n;
+	    size -= n;
+	    if (c.size() == CHUNK_SIZE)
+		end_chunk();
+	}
+    }
+
+    void close();
+    uint64_t get_raw_bytes() const { return raw_bytes; }
+    uint64_t get_stored_bytes() const { return stored_bytes; }
+};
+
+class ChunkedReader {
+    const std::string fname;
+    FILE *fp;
+    std::vector<uint8_t> chunk, stored;
+    size_t pos = 0;
+
+    bool next_chunk();
+    ChunkedReader(const ChunkedReader &);
+public:
+    ChunkedReader(const std::string &fname);
+    ~ChunkedReader() { if (fp) fclose(fp); }
+
+    // Returns the number of bytes read; less than size only at the end.
+    size_t read(void *data, size_t size) {
+	uint8_t *p = static_cast<uint8_t *>(data);
+	size_t done = 0;
+	while (done < size) {
+	    if (pos == chunk.size() && !next_chunk())
+		break;
+	    const size_t n = std::min(size-done, chunk.size()-pos);
+	    memcpy(p+done, &chunk[pos], n);
+	    pos += n;
+	    done += n;
+	}
+	return done;
+    }
+};
+
+// Typed views of the above for trivially copyable records.
+template<class T>
+class RecordWriter {
+    ChunkedWriter w;
+    uint64_t count = 0;
+public:
+    RecordWriter(const std::string &fname, bool compress, int num_threads)
+	: w(fname, compress, num_threads) {}
+    void put(const T &rec) { w.write(&rec, sizeof(T)); count++; }
+    void close() { w.close(); }
+    uint64_t size() const { return count; }
+    uint64_t get_stored_bytes() const { return w.get_stored_bytes(); }
+};
+
+template<class T>
+class RecordReader {
+    static constexpr size_t BUF_RECORDS = 65536;
+    ChunkedReader r;
+    std::vector<T> buf;
+    size_t pos = 0, len = 0;
+public:
+    RecordReader(const std::string &fname) : r(fname), buf(BUF_RECORDS) {}
+
+    // Returns false at the end.
+    bool get(T &rec) {
+	if (pos == len) {
+	    len = r.read(buf.data(), BUF_RECORDS*sizeof(T)) / sizeof(T);
+	    pos = 0;
+	    if (len == 0)
+		return false;
+	}
+	rec = buf[pos++];
+	return true;
+    }
+};
+
+#endif
@@ -0,0 +1,135 @@
+// Copyright (C) 2016  Sami Liedes
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#ifndef ClassEnumerator_hpp
+#define ClassEnumerator_hpp
+
+#include "Pos.hpp"
+#include "binom.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+
+// Visits the indices [begin, end) of the Compact_tab class (nw, nb) in
+// order, keeping pos() equal to Pos(index()) without unranking each
+// index: en passant and turn are stepped directly, and the pawn
+// placements with the colex successor of the black (then white)
+// combination, updating only the squares that changed. Disjoint
+// ranges can be given to parallel workers.
+class ClassEnumerator {
+    static_assert(NUM_ISQ <= 64, "squares must fit in a uint64_t mask");
+
+    // indices per pawn placement: ep_file -1..N-1 for both turns
+    static constexpr uint64_t PLACEMENT_SIZE = 2*(N+1);
+
+    const int nw, nb;
+    const uint64_t base, end;
+    uint64_t offset;
+    std::array<int, N> white, black; // ascending
+    uint64_t white_mask, black_mask;
+    Pos p;
+
+    static uint64_t mask(const std::array<int, N> &c, int k) {
+	uint64_t m = 0;
+	for (int i=0; i<k; i++)
+	    m |= uint64_t(1) << c[i];
+	return m;
+    }
+
+    // Returns false, and the first combination, after the last one.
+    static bool next_combination(std::array<int, N> &c, int k) {
+	for (int j=0; j<k; j++) {
+	    const int limit = j+1 < k ? c[j+1] : NUM_ISQ;
+	    if (c[j]+1 < limit) {
+		c[j]++;
+		for (int i=0; i<j; i++)
+		    c[i] = i;
+		return true;
+	    }
+	}
+	for (int i=0; i<k; i++)
+	    c[i] = i;
+	return false;
+    }
+
+    static void unrank(std::array<int, N> &c, int k, uint64_t rank) {
+	unrank_combination(c.data(), k, rank);
+	std::reverse(&c[0], &c[k]);
+    }
+
+public:
+    // begin and end are offsets from ranks_tab.base(nw, nb)
+    ClassEnumerator(int nw, int nb, uint64_t begin, uint64_t end)
+	: nw(nw), nb(nb), base(ranks_tab.base(nw, nb)), end(end), offset(begin),
+	  p(base + std::min(begin, ranks_tab.size(nw, nb)-1))
+    {
+	const uint64_t placement = begin / PLACEMENT_SIZE, b = binom(NUM_ISQ, nb);
+	unrank(white, nw, placement / b);
+	unrank(black, nb, placement % b);
+	white_mask = mask(white, nw);
+	black_mask = mask(black, nb);
+    }
+
+    ClassEnumerator(int nw, int nb) : ClassEnumerator(nw, nb, 0, ranks_tab.size(nw, nb)) {}
+
+    bool done() const { return offset >= end; }
+    pos_t index() const { return base + offset; }
+    const Pos &pos() const { return p; }
+
+    // Pawns on the same square; this holds for the whole placement.
+    bool overlaps() const { return white_mask & black_mask; }
+
+    // Same as Pos(index()).is_valid(), but cheaper.
+    bool is_valid() const {
+	return !overlaps() && (p.ep_file == -1 || (N >= 5 && p.is_ep_possible(p.ep_file)));
+    }
+
+    void next() {
+	if (p.ep_file < N-1) {
+	    p.ep_file++;
+	    offset++;
+	} else if (p.turn == 1) {
+	    p.ep_file = -1;
+	    p.turn = -1;
+	    offset++;
+	} else
+	    next_placement();
+    }
+
+    // Skips to the first index of the next pawn placement.
+    void next_placement() {
+	offset = std::min(end, (offset/PLACEMENT_SIZE + 1) * PLACEMENT_SIZE);
+	p.ep_file = -1;
+	p.turn = 1;
+	if (done())
+	    return;
+
+	if (!next_combination(black, nb))
+	    next_combination(white, nw);
+	const uint64_t old_white = white_mask, old_black = black_mask;
+	white_mask = mask(white, nw);
+	black_mask = mask(black, nb);
+	// as in Pos(pos_t), black pawns overwrite white ones
+	for (uint64_t changed = (old_white ^ white_mask) | (old_black ^ black_mask);
+	     changed; changed &= changed-1) {
+	    const int s = __builtin_ctzll(changed);
+	    p.sq[s] = (black_mask >> s & 1) ? -1 : (white_mask >> s & 1);
+	}
+    }
+};
+
+#endif
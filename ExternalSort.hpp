@@ -0,0 +1,129 @@
+// Copyright (C) 2016  Sami Liedes
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#ifndef ExternalSort_hpp
+#define ExternalSort_hpp
+
+#include "ChunkedFile.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <functional>
+#include <memory>
+#include <queue>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Sorts more records than fit in memory. put() collects records in a
+// buffer of max_records; a full buffer is sorted and written to disk
+// as a run (files prefix.run0, prefix.run1, ...). merge() then streams
+// all runs through a heap in sorted order and deletes them; if
+// everything fit in the buffer, nothing touches the disk.
+template<class T, class Less = std::less<T>>
+class ExternalSorter {
+    const std::string prefix;
+    const size_t max_records;
+    const bool compress;
+    const int num_threads;
+    std::vector<T> buf;
+    std::vector<std::string> runs;
+    uint64_t count = 0;
+
+    void write_run() {
+	std::sort(buf.begin(), buf.end(), Less());
+	runs.push_back(prefix + ".run" + std::to_string(runs.size()));
+	RecordWriter<T> w(runs.back(), compress, num_threads);
+	for (const T &rec : buf)
+	    w.put(rec);
+	buf.clear();
+    }
+
+    ExternalSorter(const ExternalSorter &);
+public:
+    ExternalSorter(const std::string &prefix, size_t max_records, bool compress,
+		   int num_threads)
+	: prefix(prefix), max_records(std::max<size_t>(max_records, 1)), compress(compress),
+	  num_threads(num_threads) {}
+
+    ~ExternalSorter() {
+	for (const std::string &r : runs)
+	    remove(r.c_str());
+    }
+
+    void put(const T &rec) {
+	buf.push_back(rec);
+	count++;
+	if (buf.size() == max_records)
+	    write_run();
+    }
+
+    // number of records put, duplicates included
+    uint64_t size() const { return count; }
+
+    // Calls f(rec) on all records in order, only once for equal ones
+    // if unique is set. Can only be called once.
+    template<class F>
+    void merge(F f, bool unique) {
+	const Less less;
+	bool have_last = false;
+	T last;
+	auto emit = [&](const T &rec) {
+	    if (unique && have_last && !less(last, rec))
+		return;
+	    f(rec);
+	    last = rec;
+	    have_last = true;
+	};
+
+	if (runs.empty()) {
+	    std::sort(buf.begin(), buf.end(), less);
+	    for (const T &rec : buf)
+		emit(rec);
+	    std::vector<T>().swap(buf);
+	    return;
+	}
+	if (!buf.empty())
+	    write_run();
+	std::vector<T>().swap(buf);
+
+	std::vector<std::unique_ptr<RecordReader<T>>> readers;
+	typedef std::pair<T, size_t> Head;
+	auto greater = [&](const Head &a, const Head &b) { return less(b.first, a.first); };
+	std::priority_queue<Head, std::vector<Head>, decltype(greater)> heap(greater);
+	for (size_t i=0; i<runs.size(); i++) {
+	    readers.emplace_back(new RecordReader<T>(runs[i]));
+	    T rec;
+	    if (readers[i]->get(rec))
+		heap.emplace(rec, i);
+	}
+	while (!heap.empty()) {
+	    const Head h = heap.top();
+	    heap.pop();
+	    emit(h.first);
+	    T rec;
+	    if (readers[h.second]->get(rec))
+		heap.emplace(rec, h.second);
+	}
+	readers.clear();
+	for (const std::string &r : runs)
+	    remove(r.c_str());
+	runs.clear();
+    }
+};
+
+#endif
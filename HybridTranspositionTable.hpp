@@ -0,0 +1,152 @@
+// Copyright (C) 2016  Sami Liedes
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#ifndef HybridTranspositionTable_hpp
+#define HybridTranspositionTable_hpp
+
+#include "PackedResultArray.hpp"
+#include "Pos.hpp"
+#include "TranspositionTable.hpp"
+
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <string>
+
+// The material classes of Compact_tab with at most MAX_DENSE_CLASS
+// white-to-move indices get a dense region with one PackedResultArray
+// slot per index, so their results are exact and never evicted; all
+// other positions go to the hashed table Hashed. Positions must be
+// canonical (white to move), as the search stores them.
+template<uint64_t MAX_DENSE_CLASS, class Hashed>
+class HybridTranspositionTable : public TranspositionTableBase {
+    static constexpr int NUM_CLASSES = (N+1)*(N+1)-1; // as in Compact_tab
+    static constexpr uint64_t NOT_DENSE = UINT64_MAX;
+
+    // By Compact_tab index: the first slot of the class in dense, or
+    // NOT_DENSE.
+    std::array<uint64_t, NUM_CLASSES> dense_base;
+    int num_dense_classes = 0;
+    PackedResultArray dense;
+    Hashed hashed;
+
+    static Entry entry(TpResult result) {
+	Entry e;
+	e.pos = 0;
+	e.result = static_cast<int>(result);
+	return e;
+    }
+
+    // white-to-move indices of a class, as in Pos::pack()
+    static uint64_t class_size(int nw, int nb) {
+	return binom(NUM_ISQ, nw) * binom(NUM_ISQ, nb) * (N+1);
+    }
+
+    // The dense slot of pos, or NOT_DENSE. Drops the turn bit of the
+    // offset within the class (see Pos::pack()).
+    TP_INLINE uint64_t dense_slot(uint64_t pos) const {
+	const int c = ranks_tab.find(pos);
+	if (dense_base[c] == NOT_DENSE)
+	    return NOT_DENSE;
+	const uint64_t offset = pos - ranks_tab[c];
+	assert(offset/(N+1)%2 == 0);
+	return dense_base[c] + offset/(2*(N+1))*(N+1) + offset%(N+1);
+    }
+    HybridTranspositionTable(const HybridTranspositionTable &);
+public:
+    HybridTranspositionTable() {
+	// may run before ranks_tab is constructed
+	init_binom();
+	uint64_t size = 0;
+	for (int nw=0; nw<=N; nw++)
+	    for (int nb=0; nb<=N; nb++) {
+		if (nw == 0 && nb == 0)
+		    continue;
+		uint64_t &base = dense_base[nw*(N+1)+nb-1];
+		base = NOT_DENSE;
+		if (class_size(nw, nb) <= MAX_DENSE_CLASS) {
+		    base = size;
+		    size += class_size(nw, nb);
+		    num_dense_classes++;
+		}
+	    }
+	dense.resize(size);
+    }
+
+    TP_INLINE TpResult probe(uint64_t pos) {
+	const uint64_t slot = dense_slot(pos);
+	if (slot == NOT_DENSE)
+	    return hashed.probe(pos);
+	const TpResult res = dense.get(slot);
+	count_probe(entry(res), 0);
+	return res;
+    }
+
+    TP_INLINE void add(uint64_t pos, TpResult result) {
+	assert(result != TpResult::NONE);
+	const uint64_t slot = dense_slot(pos);
+	if (slot == NOT_DENSE) {
+	    hashed.add(pos, result);
+	    return;
+	}
+	TpResult stored;
+	const TpResult old = dense.store(slot, result, stored);
+	if (stored != result)
+	    bump(shard().merges);
+	count_store(entry(old), entry(stored));
+    }
+
+    // same interface as CachedTranspositionTable; everything is stored
+    void add(uint64_t pos, TpResult result, uint64_t /*subtree_nodes*/) { add(pos, result); }
+
+    bool is_empty_slot(uint64_t pos) const {
+	const uint64_t slot = dense_slot(pos);
+	if (slot == NOT_DENSE)
+	    return hashed.is_empty_slot(pos);
+	return dense.get(slot) == TpResult::NONE;
+    }
+
+    // both parts
+    TpTableStats stats() const {
+	TpTableStats st = dense_stats();
+	st += hashed.stats();
+	return st;
+    }
+    size_t size() const { return stats().occupied; }
+    size_t get_capacity() const { return dense.size() + hashed.get_capacity(); }
+
+    // the parts separately
+    TpTableStats dense_stats() const { return TranspositionTableBase::stats(); }
+    TpTableStats hashed_stats() const { return hashed.stats(); }
+    int get_num_dense_classes() const { return num_dense_classes; }
+    size_t get_dense_capacity() const { return dense.size(); }
+    uint64_t dense_bytes() const { return dense.bytes(); }
+    size_t get_hashed_capacity() const { return hashed.get_capacity(); }
+    uint64_t hashed_bytes() const { return hashed.get_capacity()*sizeof(Entry); }
+
+    // The dense region goes to a file of its own, fname + ".dense".
+    void save(const char *fname) const {
+	hashed.save(fname);
+	dense.write((std::string(fname) + ".dense").c_str());
+    }
+    void load(const char *fname) {
+	hashed.load(fname);
+	dense.read((std::string(fname) + ".dense").c_str());
+	reset_occupancy(dense.count_results());
+    }
+};
+
+#endif
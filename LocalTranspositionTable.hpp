@@ -0,0 +1,66 @@
+// Copyright (C) 2016  Sami Liedes
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#ifndef LocalTranspositionTable_hpp
+#define LocalTranspositionTable_hpp
+
+#include "TranspositionTable.hpp"
+
+#include <array>
+#include <cassert>
+#include <cstdint>
+
+// A small table owned by a single thread, meant to stay in the CPU
+// cache. With so few slots the quotient pos/CAPACITY does not fit in
+// the 29 bits of TranspositionTableBase::Entry, so entries are 64
+// bits wide; no atomics are needed since only the owner touches it.
+template<size_t CAPACITY>
+class LocalTranspositionTable {
+    static constexpr int RESULT_BITS = 3;
+    std::array<uint64_t, CAPACITY> tab;
+
+    static size_t hash(uint64_t pos) { return pos%CAPACITY; }
+    static uint64_t make_entry(uint64_t pos, TpResult result) {
+	return (pos/CAPACITY) << RESULT_BITS | static_cast<uint64_t>(result);
+    }
+    static TpResult entry_result(uint64_t e) {
+	return TpResult(e & ((1 << RESULT_BITS) - 1));
+    }
+public:
+    static constexpr size_t capacity = CAPACITY;
+
+    LocalTranspositionTable() { clear(); }
+
+    void clear() { tab.fill(0); }
+
+    TP_INLINE TpResult probe(uint64_t pos) const {
+	uint64_t e = tab[hash(pos)];
+	if (e >> RESULT_BITS != pos/CAPACITY)
+	    return TpResult::NONE;
+	return entry_result(e);
+    }
+
+    TP_INLINE void add(uint64_t pos, TpResult result) {
+	assert(result != TpResult::NONE);
+	uint64_t &slot = tab[hash(pos)];
+	if ((result == TpResult::LOWER_BOUND_0 || result == TpResult::UPPER_BOUND_0) &&
+	    slot >> RESULT_BITS == pos/CAPACITY)
+	    result = merge_results(result, entry_result(slot));
+	slot = make_entry(pos, result);
+    }
+};
+
+#endif
@@ -24,24 +24,25 @@
 #include <memory>
 
 template<size_t CAPACITY>
-class MemTranspositionTable : public TranspositionTable<CAPACITY> {
-    typedef std::array<std::atomic<typename TranspositionTable<CAPACITY>::Entry>, CAPACITY> TpArray;
-    //typedef std::array<typename TranspositionTable<CAPACITY>::Entry, CAPACITY> TpArray;
+class MemTranspositionTable final
+    : public TranspositionTable<MemTranspositionTable<CAPACITY>, CAPACITY> {
+    typedef TranspositionTable<MemTranspositionTable<CAPACITY>, CAPACITY> Super;
+    friend Super;
+    typedef std::array<std::atomic<typename Super::Entry>, CAPACITY> TpArray;
+    //typedef std::array<typename Super::Entry, CAPACITY> TpArray;
     std::unique_ptr<TpArray> tab;
     MemTranspositionTable(const MemTranspositionTable &);
 protected:
-    void write_entry(size_t n, const TranspositionTableBase::Entry &entry) override {
+    TP_INLINE void write_entry(size_t n, const TranspositionTableBase::Entry &entry) {
 	(*tab)[n].store(entry, std::memory_order_relaxed);
 	//(*tab)[n] = entry;
     }
-    TranspositionTableBase::Entry read_entry(size_t n) const override {
+    TP_INLINE TranspositionTableBase::Entry read_entry(size_t n) const {
 	return (*tab)[n].load(std::memory_order_relaxed);
 	//return (*tab)[n];
     }
 public:
     MemTranspositionTable();
-
-    size_t size() const override; // estimate
 };
 
 template<size_t CAPACITY>
@@ -55,13 +56,4 @@ MemTranspositionTable<CAPACITY>::MemTranspositionTable()
 	write_entry(i, e);
 }
 
-template<size_t CAPACITY>
-size_t MemTranspositionTable<CAPACITY>::size() const {
-    size_t count = 0;
-    for (size_t i=0; i<CAPACITY/10240; i++)
-	if (TpResult(read_entry(i).result) != TpResult::NONE)
-	    count++;
-    return count*10240;
-}
-
 #endif
@@ -0,0 +1,125 @@
+// Copyright (C) 2016  Sami Liedes
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#ifndef MoveOrdering_hpp
+#define MoveOrdering_hpp
+
+#include "Pos.hpp"
+#include "ThreadSlot.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+
+// Orders the moves of a node for the search: by the static Move::value,
+// and moves of equal value by the killer moves of the depth (the last
+// moves that caused a cutoff there) and then by a history table of how
+// often and how deep each from-to move of each side has caused cutoffs.
+//
+// Letting the killers or the history override Move::value was tried and
+// searched 10-90% more nodes on the bench positions; the static value
+// is a good guess in pawn endings, and the dynamic heuristics are best
+// at telling apart the many moves it scores equal.
+//
+// The tables are per thread slot, so they are only touched by one
+// thread at a time. The moves are picked lazily by a selection step,
+// since after a cutoff the rest need not be ordered at all.
+class MoveOrdering {
+public:
+    static constexpr int MAX_DEPTH = MAX_PROGRESS + 1;
+    static constexpr int NUM_KILLERS = 2;
+    // the history of a side is halved when an entry reaches this
+    static constexpr uint32_t MAX_HISTORY = 1U << 30;
+
+    typedef std::array<Pos::Move, MAX_LEGAL_MOVES> Moves;
+    typedef std::array<int64_t, MAX_LEGAL_MOVES> Keys;
+private:
+    typedef std::array<std::array<uint32_t, NUM_ISQ>, NUM_ISQ> History; // [from][to]
+    struct alignas(64) Slot {
+	std::array<History, 2> history{}; // [side to move is black]
+	std::array<std::array<int16_t, NUM_KILLERS>, MAX_DEPTH+1> killers;
+	Slot() {
+	    for (auto &k : killers)
+		k.fill(-1);
+	}
+    };
+    std::array<Slot, MAX_THREAD_SLOTS> slots;
+
+    static int move_id(const Pos::Move &m) { return m.from*NUM_ISQ + m.to; }
+    static int side(const Pos &p) { return p.get_turn() == -1; }
+public:
+    bool dynamic = true; // false = order by Move::value only
+
+    void score(const Pos &p, int depth, const Moves &moves, int num_moves, Keys &keys) {
+	const Slot &s = slots[thread_slot()];
+	const History &h = s.history[side(p)];
+	const auto &killers = s.killers[std::min(depth, MAX_DEPTH)];
+	for (int i=0; i<num_moves; i++) {
+	    const Pos::Move &m = moves[i];
+	    // value in the high 32 bits, then the killer rank, then history
+	    int64_t key = int64_t(m.value) << 32;
+	    if (dynamic) {
+		key |= h[m.from][m.to];
+		for (int k=0; k<NUM_KILLERS; k++)
+		    if (killers[k] == move_id(m)) {
+			key |= int64_t(NUM_KILLERS-k) << 30;
+			break;
+		    }
+	    }
+	    keys[i] = key;
+	}
+    }
+
+    // Makes moves[i] go before all others, e.g. the best move found by
+    // an earlier search of the position.
+    static void try_first(Keys &keys, int i) { keys[i] |= int64_t(1) << 62; }
+
+    // Moves the best of moves[i..num_moves) to i.
+    static void select(Moves &moves, Keys &keys, int i, int num_moves) {
+	int best = i;
+	for (int j=i+1; j<num_moves; j++)
+	    if (keys[j] > keys[best])
+		best = j;
+	if (best != i) {
+	    std::swap(moves[i], moves[best]);
+	    std::swap(keys[i], keys[best]);
+	}
+    }
+
+    // Records that m caused a cutoff in p at depth.
+    void cutoff(const Pos &p, int depth, const Pos::Move &m) {
+	if (!dynamic)
+	    return;
+	Slot &s = slots[thread_slot()];
+	History &h = s.history[side(p)];
+	// deeper subtrees (less progress so far) count more
+	const uint32_t remaining = MAX_PROGRESS - p.get_progress() + 1;
+	h[m.from][m.to] += remaining*remaining;
+	if (h[m.from][m.to] >= MAX_HISTORY)
+	    for (auto &from : h)
+		for (uint32_t &x : from)
+		    x /= 2;
+
+	auto &killers = s.killers[std::min(depth, MAX_DEPTH)];
+	if (killers[0] != move_id(m)) {
+	    for (int k=NUM_KILLERS-1; k>0; k--)
+		killers[k] = killers[k-1];
+	    killers[0] = move_id(m);
+	}
+    }
+};
+
+#endif
@@ -0,0 +1,91 @@
+// Copyright (C) 2016  Sami Liedes
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#ifndef MoveScores_hpp
+#define MoveScores_hpp
+
+#include "Pos.hpp"
+
+#include <cstdint>
+
+// Move::value by Pos::MoveFeatures, learned from the tablebases by
+// movestats: for every cell [kind][rank][file_centrality][unstoppable],
+// how often (per mille, smoothed) a move with those features was one
+// of the best moves in the positions where not all moves are equally
+// good. Board sizes without a table below use the formula in
+// Pos::get_legal_moves(), as do builds with -DNO_MOVE_SCORES.
+//
+// The tables are the output of
+//   ./tbgen -o tb 5 && ./movestats tb 5
+// built with -DBOARD_N for the board size. Only 8x8 has one so far; on
+// the smaller boards of the bench the learned tables searched more
+// nodes than the formula.
+
+static constexpr int NUM_FILE_CENTRALITIES = (N+1)/2;
+
+typedef int16_t MoveScoreTable[Pos::NUM_MOVE_KINDS][NUM_RANKS][NUM_FILE_CENTRALITIES][2];
+
+#ifndef NO_MOVE_SCORES
+
+#if BOARD_N == 8
+// movestats, 5 pawns: 3127029 positions with a choice, 11111113 moves
+#define HAVE_MOVE_SCORES
+static constexpr MoveScoreTable MOVE_SCORES = {
+    { // push; by rank, file centrality, unstoppable
+	{{147, 143}, {152, 145}, {150, 131}, {149, 132}},
+	{{153, 283}, {168, 265}, {173, 261}, {172, 262}},
+	{{169, 343}, {181, 350}, {185, 349}, {184, 349}},
+	{{289, 574}, {315, 581}, {323, 582}, {323, 582}},
+	{{500, 991}, {500, 990}, {500, 990}, {500, 990}},
+	{{500, 500}, {500, 500}, {500, 500}, {500, 500}},
+    },
+    { // double push; by rank, file centrality, unstoppable
+	{{172, 293}, {169, 253}, {174, 244}, {173, 246}},
+	{{500, 500}, {500, 500}, {500, 500}, {500, 500}},
+	{{500, 500}, {500, 500}, {500, 500}, {500, 500}},
+	{{500, 500}, {500, 500}, {500, 500}, {500, 500}},
+	{{500, 500}, {500, 500}, {500, 500}, {500, 500}},
+	{{500, 500}, {500, 500}, {500, 500}, {500, 500}},
+    },
+    { // capture; by rank, file centrality, unstoppable
+	{{839, 847}, {840, 846}, {843, 839}, {842, 839}},
+	{{593, 748}, {594, 739}, {599, 740}, {599, 739}},
+	{{380, 581}, {399, 594}, {385, 590}, {386, 589}},
+	{{346, 722}, {370, 728}, {338, 725}, {344, 725}},
+	{{500, 955}, {500, 956}, {500, 955}, {500, 955}},
+	{{500, 500}, {500, 500}, {500, 500}, {500, 500}},
+    },
+    { // en passant; by rank, file centrality, unstoppable
+	{{500, 500}, {500, 500}, {500, 500}, {500, 500}},
+	{{500, 500}, {500, 500}, {500, 500}, {500, 500}},
+	{{500, 500}, {500, 500}, {500, 500}, {500, 500}},
+	{{247, 599}, {320, 628}, {261, 630}, {265, 630}},
+	{{500, 500}, {500, 500}, {500, 500}, {500, 500}},
+	{{500, 500}, {500, 500}, {500, 500}, {500, 500}},
+    },
+};
+#endif
+
+#endif
+
+#ifdef HAVE_MOVE_SCORES
+static constexpr bool MOVE_SCORES_LEARNED = true;
+#else
+static constexpr bool MOVE_SCORES_LEARNED = false;
+static constexpr MoveScoreTable MOVE_SCORES = {};
+#endif
+
+#endif
@@ -0,0 +1,120 @@
+// Copyright (C) 2016  Sami Liedes
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#ifndef PackedResultArray_hpp
+#define PackedResultArray_hpp
+
+#include "TranspositionTable.hpp"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+
+// One TpResult per index for direct-mapped tables. A slot needs all
+// NUM_TP_RESULTS states, bounds included, so they are packed three to
+// a byte (6^3 <= 256): 8/3 bits per index. Stores update the byte with
+// a CAS, so concurrent stores to the same byte are safe.
+class PackedResultArray {
+    static constexpr int PER_BYTE = 3;
+    std::unique_ptr<std::atomic<uint8_t>[]> tab;
+    size_t count = 0;
+
+    static constexpr int place_value(int i) {
+	return i == 0 ? 1 : NUM_TP_RESULTS*place_value(i-1);
+    }
+    static TpResult unpack(uint8_t byte, int i) {
+	return TpResult(byte / place_value(i) % NUM_TP_RESULTS);
+    }
+    size_t num_bytes() const { return (count + PER_BYTE-1) / PER_BYTE; }
+public:
+    // all NONE
+    void resize(size_t n) {
+	count = n;
+	tab.reset(new std::atomic<uint8_t>[num_bytes()]);
+	for (size_t i=0; i<num_bytes(); i++)
+	    tab[i].store(0, std::memory_order_relaxed);
+    }
+
+    size_t size() const { return count; }
+    size_t bytes() const { return num_bytes(); }
+
+    TP_INLINE TpResult get(size_t i) const {
+	return unpack(tab[i/PER_BYTE].load(std::memory_order_relaxed), i%PER_BYTE);
+    }
+
+    // Stores result, merged with the old one if it is a bound as in
+    // TranspositionTable::add(). Returns the old result; the stored one
+    // goes to stored.
+    TP_INLINE TpResult store(size_t i, TpResult result, TpResult &stored) {
+	std::atomic<uint8_t> &byte = tab[i/PER_BYTE];
+	const int place = place_value(i%PER_BYTE);
+	uint8_t old = byte.load(std::memory_order_relaxed), updated;
+	TpResult old_res;
+	do {
+	    old_res = unpack(old, i%PER_BYTE);
+	    stored = result;
+	    if (result == TpResult::LOWER_BOUND_0 || result == TpResult::UPPER_BOUND_0 || DEBUG_TP)
+		stored = merge_results(result, old_res);
+	    updated = old + (static_cast<int>(stored) - static_cast<int>(old_res)) * place;
+	} while (!byte.compare_exchange_weak(old, updated, std::memory_order_relaxed));
+	return old_res;
+    }
+
+    // number of indices holding each result
+    std::array<int64_t, NUM_TP_RESULTS> count_results() const {
+	std::array<int64_t, NUM_TP_RESULTS> by_result{{0}};
+	for (size_t i=0; i<count; i++)
+	    by_result[static_cast<int>(get(i))]++;
+	return by_result;
+    }
+
+    // The file holds the size and the packed bytes. read() aborts if
+    // the size differs from ours.
+    void write(const char *fname) const {
+	FILE *fp = fopen(fname, "wb");
+	bool ok = fp && fwrite(&count, sizeof(count), 1, fp) == 1;
+	for (size_t i=0; ok && i<num_bytes(); i++) {
+	    const uint8_t b = tab[i].load(std::memory_order_relaxed);
+	    ok = fwrite(&b, 1, 1, fp) == 1;
+	}
+	if (!ok || fclose(fp) != 0) {
+	    std::cerr << "Could not write " << fname << std::endl;
+	    abort();
+	}
+    }
+
+    void read(const char *fname) {
+	FILE *fp = fopen(fname, "rb");
+	size_t n;
+	bool ok = fp && fread(&n, sizeof(n), 1, fp) == 1 && n == count;
+	for (size_t i=0; ok && i<num_bytes(); i++) {
+	    uint8_t b;
+	    ok = fread(&b, 1, 1, fp) == 1;
+	    tab[i].store(b, std::memory_order_relaxed);
+	}
+	if (!ok) {
+	    std::cerr << "Could not read " << fname << " or wrong size" << std::endl;
+	    abort();
+	}
+	fclose(fp);
+    }
+};
+
+#endif
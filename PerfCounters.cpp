@@ -0,0 +1,248 @@
+// Copyright (C) 2016  Sami Liedes
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#include "PerfCounters.hpp"
+
+#ifdef PERF_COUNTERS
+
+#include "ThreadSlot.hpp"
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <linux/perf_event.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+using std::array;
+using std::atomic;
+using std::endl;
+
+namespace {
+
+struct EventType {
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+};
+
+// Event 0 is wall time from steady_clock, which every machine has.
+const array<EventType, 5> HW_EVENTS = {{
+    {"cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+    {"instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+    {"LLC misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+    {"dTLB misses", PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_DTLB |
+     PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16},
+    {"branch misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+}};
+constexpr int NUM_EVENTS = HW_EVENTS.size() + 1;
+
+const char *const PHASE_NAMES[NUM_PERF_PHASES] = {
+    "movegen", "canonize+pack", "table probe", "table store", "thread wait", "recursion",
+};
+
+typedef array<uint64_t, NUM_EVENTS> Counts;
+
+// written only by the owner of the slot, as in SearchCounters
+struct alignas(64) Slot {
+    array<array<atomic<uint64_t>, NUM_EVENTS>, NUM_PERF_PHASES> phases;
+    Slot() {
+	for (auto &ph : phases)
+	    for (auto &c : ph)
+		c.store(0, std::memory_order_relaxed);
+    }
+};
+array<Slot, MAX_THREAD_SLOTS> slots;
+
+// whether each event could be opened on the main thread
+array<bool, NUM_EVENTS> available;
+
+#if defined(__x86_64__) || defined(__i386__)
+inline uint64_t rdpmc(uint32_t counter) {
+    uint32_t lo, hi;
+    asm volatile("rdpmc" : "=a"(lo), "=d"(hi) : "c"(counter));
+    return lo | uint64_t(hi) << 32;
+}
+#endif
+
+class ThreadCounters {
+    array<int, HW_EVENTS.size()> fds;
+    array<perf_event_mmap_page *, HW_EVENTS.size()> pages;
+    bool opened = false;
+
+    static uint64_t read_event(int fd, perf_event_mmap_page *pc) {
+#if defined(__x86_64__) || defined(__i386__)
+	// see the comment on perf_event_mmap_page in linux/perf_event.h
+	if (pc) {
+	    while (true) {
+		const uint32_t seq = pc->lock;
+		std::atomic_signal_fence(std::memory_order_acq_rel);
+		const uint32_t idx = pc->index;
+		if (!pc->cap_user_rdpmc || idx == 0)
+		    break;
+		int64_t pmc = rdpmc(idx-1);
+		pmc <<= 64 - pc->pmc_width;
+		pmc >>= 64 - pc->pmc_width;
+		const uint64_t count = pc->offset + pmc;
+		std::atomic_signal_fence(std::memory_order_acq_rel);
+		if (pc->lock == seq)
+		    return count;
+	    }
+	}
+#endif
+	uint64_t count;
+	if (::read(fd, &count, sizeof(count)) != sizeof(count))
+	    return 0;
+	return count;
+    }
+public:
+    PerfPhaseId phase = PERF_RECURSION;
+    Counts last;
+
+    void open() {
+	for (size_t i=0; i<HW_EVENTS.size(); i++) {
+	    perf_event_attr attr;
+	    memset(&attr, 0, sizeof(attr));
+	    attr.size = sizeof(attr);
+	    attr.type = HW_EVENTS[i].type;
+	    attr.config = HW_EVENTS[i].config;
+	    attr.exclude_kernel = 1;
+	    attr.exclude_hv = 1;
+	    fds[i] = syscall(SYS_perf_event_open, &attr, 0 /* this thread */, -1, -1, 0);
+	    pages[i] = nullptr;
+	    if (fds[i] < 0)
+		continue;
+	    void *p = mmap(nullptr, sysconf(_SC_PAGESIZE), PROT_READ, MAP_SHARED, fds[i], 0);
+	    if (p != MAP_FAILED)
+		pages[i] = static_cast<perf_event_mmap_page *>(p);
+	}
+	opened = true;
+	read(last);
+    }
+
+    bool is_open() const { return opened; }
+    bool has_event(int i) const { return fds[i] >= 0; }
+
+    void read(Counts &c) const {
+	c[0] = std::chrono::duration_cast<std::chrono::nanoseconds>(
+	    std::chrono::steady_clock::now().time_since_epoch()).count();
+	for (size_t i=0; i<HW_EVENTS.size(); i++)
+	    c[i+1] = fds[i] >= 0 ? read_event(fds[i], pages[i]) : 0;
+    }
+
+    ~ThreadCounters() {
+	if (!opened)
+	    return;
+	for (size_t i=0; i<HW_EVENTS.size(); i++) {
+	    if (pages[i])
+		munmap(pages[i], sysconf(_SC_PAGESIZE));
+	    if (fds[i] >= 0)
+		close(fds[i]);
+	}
+    }
+};
+
+thread_local ThreadCounters thread_counters;
+
+void print_counts(std::ostream &os, const char *label, const array<Counts, NUM_PERF_PHASES> &c) {
+    Counts total{};
+    for (const Counts &ph : c)
+	for (int e=0; e<NUM_EVENTS; e++)
+	    total[e] += ph[e];
+    if (total[0] == 0)
+	return;
+
+    char buf[256];
+    os << label << endl;
+    snprintf(buf, sizeof(buf), "  %-14s %14s", "phase", "ms");
+    os << buf;
+    for (size_t i=0; i<HW_EVENTS.size(); i++)
+	if (available[i+1]) {
+	    snprintf(buf, sizeof(buf), " %16s", HW_EVENTS[i].name);
+	    os << buf;
+	}
+    if (available[1] && available[2])
+	os << "     IPC";
+    os << endl;
+    for (int ph=0; ph<=NUM_PERF_PHASES; ph++) {
+	const Counts &x = ph < NUM_PERF_PHASES ? c[ph] : total;
+	snprintf(buf, sizeof(buf), "  %-14s %14.1f", ph < NUM_PERF_PHASES ? PHASE_NAMES[ph] : "total",
+		 x[0]*1e-6);
+	os << buf;
+	for (size_t i=0; i<HW_EVENTS.size(); i++)
+	    if (available[i+1]) {
+		snprintf(buf, sizeof(buf), " %16llu", (unsigned long long)x[i+1]);
+		os << buf;
+	    }
+	if (available[1] && available[2]) {
+	    snprintf(buf, sizeof(buf), " %7.2f", x[2]/double(x[1] ? x[1] : 1));
+	    os << buf;
+	}
+	os << endl;
+    }
+}
+
+}
+
+void perf_init(std::ostream &os) {
+    thread_counters.open();
+    available[0] = true;
+    os << "Performance counters:";
+    for (size_t i=0; i<HW_EVENTS.size(); i++) {
+	available[i+1] = thread_counters.has_event(i);
+	os << " " << HW_EVENTS[i].name << (available[i+1] ? "" : " (unavailable)") << ",";
+    }
+    os << " wall time" << endl;
+}
+
+PerfPhaseId perf_switch(PerfPhaseId phase) {
+    ThreadCounters &t = thread_counters;
+    if (!t.is_open())
+	t.open();
+    Counts now;
+    t.read(now);
+    auto &totals = slots[thread_slot()].phases[t.phase];
+    for (int e=0; e<NUM_EVENTS; e++)
+	totals[e].store(totals[e].load(std::memory_order_relaxed) + now[e] - t.last[e],
+			std::memory_order_relaxed);
+    t.last = now;
+    const PerfPhaseId prev = t.phase;
+    t.phase = phase;
+    return prev;
+}
+
+void perf_report(std::ostream &os, bool per_slot) {
+    array<Counts, NUM_PERF_PHASES> total{};
+    for (int s=0; s<thread_slots_used(); s++) {
+	array<Counts, NUM_PERF_PHASES> c;
+	for (int ph=0; ph<NUM_PERF_PHASES; ph++)
+	    for (int e=0; e<NUM_EVENTS; e++) {
+		c[ph][e] = slots[s].phases[ph][e].load(std::memory_order_relaxed);
+		total[ph][e] += c[ph][e];
+	    }
+	if (per_slot) {
+	    char label[64];
+	    snprintf(label, sizeof(label), "Thread slot %d:", s);
+	    print_counts(os, label, c);
+	}
+    }
+    print_counts(os, "All threads:", total);
+}
+
+#endif
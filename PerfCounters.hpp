@@ -0,0 +1,79 @@
+// Copyright (C) 2016  Sami Liedes
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#ifndef PerfCounters_hpp
+#define PerfCounters_hpp
+
+#include <ostream>
+
+// Hardware performance counters (perf_event_open) attributed to the
+// phases of a search node. Every thread has a current phase, which is
+// PERF_RECURSION (everything not in another phase, such as do_move(),
+// copying positions and starting threads) unless a PerfPhase is in
+// scope; at every phase change the counters are read (with rdpmc where
+// the kernel allows it) and the difference is added to the phase that
+// ended, in per-thread-slot totals.
+//
+// Build with -DPERF_COUNTERS to enable; otherwise all of this compiles
+// to nothing. Counters the machine does not have (e.g. in most virtual
+// machines) are reported as unavailable and left out.
+
+enum PerfPhaseId {
+    PERF_MOVEGEN, // get_legal_moves() and symmetry pruning
+    PERF_CANONIZE_PACK,
+    PERF_TP_PROBE, // tablebases and transposition table
+    PERF_TP_STORE,
+    PERF_THREAD_WAIT, // waiting for a free thread or for threads to finish
+    PERF_RECURSION,
+    NUM_PERF_PHASES
+};
+
+#ifdef PERF_COUNTERS
+
+// Opens the counters for the calling thread and prints which of them
+// are available.
+void perf_init(std::ostream &os);
+
+// Makes phase the current phase of the calling thread and returns the
+// previous one.
+PerfPhaseId perf_switch(PerfPhaseId phase);
+
+// Prints the totals of every phase, overall and (if per_slot) for
+// every thread slot.
+void perf_report(std::ostream &os, bool per_slot);
+
+class PerfPhase {
+    PerfPhaseId prev;
+public:
+    explicit PerfPhase(PerfPhaseId phase) : prev(perf_switch(phase)) {}
+    ~PerfPhase() { perf_switch(prev); }
+    PerfPhase(const PerfPhase &) = delete;
+    PerfPhase &operator=(const PerfPhase &) = delete;
+};
+
+#else
+
+static inline void perf_init(std::ostream &) {}
+static inline void perf_report(std::ostream &, bool) {}
+
+class PerfPhase {
+public:
+    explicit PerfPhase(PerfPhaseId) {}
+};
+
+#endif
+
+#endif
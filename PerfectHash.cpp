@@ -0,0 +1,110 @@
+// Copyright (C) 2016  Sami Liedes
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#include "PerfectHash.hpp"
+#include <cstdlib>
+#include <iostream>
+
+using std::cerr;
+using std::endl;
+using std::vector;
+
+void PerfectHash::build(vector<uint64_t> keys) {
+    num_keys = keys.size();
+    levels.clear();
+    bits.clear();
+    for (int level=0; level<MAX_LEVELS && !keys.empty(); level++) {
+	const uint64_t num_bits = (uint64_t(keys.size()*GAMMA) + 63) / 64 * 64;
+	vector<uint64_t> seen(num_bits/64), collided(num_bits/64);
+	for (uint64_t key : keys) {
+	    const uint64_t b = reduce(hash(key, level), num_bits);
+	    const uint64_t mask = 1ULL << b%64;
+	    if (seen[b/64] & mask)
+		collided[b/64] |= mask;
+	    seen[b/64] |= mask;
+	}
+
+	Level l;
+	l.first_bit = bits.size()*64;
+	l.num_bits = num_bits;
+	levels.push_back(l);
+	for (size_t i=0; i<seen.size(); i++)
+	    bits.push_back(seen[i] & ~collided[i]);
+
+	size_t left = 0;
+	for (uint64_t key : keys) {
+	    const uint64_t b = reduce(hash(key, level), num_bits);
+	    if (collided[b/64] >> b%64 & 1)
+		keys[left++] = key;
+	}
+	keys.resize(left);
+    }
+    std::sort(keys.begin(), keys.end());
+    fallback = keys;
+
+    ranks.assign((bits.size() + RANK_WORDS-1) / RANK_WORDS, 0);
+    uint64_t r = 0;
+    for (size_t w=0; w<bits.size(); w++) {
+	if (w%RANK_WORDS == 0)
+	    ranks[w/RANK_WORDS] = r;
+	r += __builtin_popcountll(bits[w]);
+    }
+}
+
+template<class T>
+static void write_vector(FILE *fp, const vector<T> &v) {
+    const uint64_t n = v.size();
+    if (fwrite(&n, sizeof(n), 1, fp) != 1 || fwrite(v.data(), sizeof(T), n, fp) != n) {
+	cerr << "Short write of perfect hash" << endl;
+	abort();
+    }
+}
+
+template<class T>
+static void read_vector(FILE *fp, vector<T> &v) {
+    uint64_t n;
+    if (fread(&n, sizeof(n), 1, fp) != 1) {
+	cerr << "Short read of perfect hash" << endl;
+	abort();
+    }
+    v.resize(n);
+    if (fread(v.data(), sizeof(T), n, fp) != n) {
+	cerr << "Short read of perfect hash" << endl;
+	abort();
+    }
+}
+
+void PerfectHash::write(FILE *fp) const {
+    write_vector(fp, vector<uint64_t>{num_keys});
+    write_vector(fp, levels);
+    write_vector(fp, bits);
+    write_vector(fp, ranks);
+    write_vector(fp, fallback);
+}
+
+void PerfectHash::read(FILE *fp) {
+    vector<uint64_t> n;
+    read_vector(fp, n);
+    read_vector(fp, levels);
+    read_vector(fp, bits);
+    read_vector(fp, ranks);
+    read_vector(fp, fallback);
+    if (n.size() != 1) {
+	cerr << "Corrupt perfect hash" << endl;
+	abort();
+    }
+    num_keys = n[0];
+}
@@ -0,0 +1,92 @@
+// Copyright (C) 2016  Sami Liedes
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#ifndef PerfectHash_hpp
+#define PerfectHash_hpp
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+// Minimal perfect hash of a fixed set of keys to [0, size()), in the
+// style of BBHash: every level is a bit array of GAMMA bits per key
+// still left. A key that hashes alone to its bit at some level sets
+// it, the rest go on to the next level. lookup() finds the first level
+// where the key's bit is set and returns the rank of that bit; keys
+// left after MAX_LEVELS levels are kept in a sorted list. About 3.7
+// bits per key.
+//
+// Keys not in the set give an arbitrary index (or size() at most).
+class PerfectHash {
+    static constexpr double GAMMA = 2.0;
+    static constexpr int MAX_LEVELS = 32;
+    static constexpr int RANK_WORDS = 8; // words per rank sample
+
+    struct Level {
+	uint64_t first_bit, num_bits;
+    };
+    std::vector<Level> levels;
+    std::vector<uint64_t> bits; // the levels one after the other
+    std::vector<uint64_t> ranks; // set bits before each RANK_WORDS words
+    std::vector<uint64_t> fallback;
+    uint64_t num_keys = 0;
+
+    static uint64_t hash(uint64_t key, int level) {
+	// splitmix64 finalizer
+	uint64_t z = key + (level+1)*0x9e3779b97f4a7c15ULL;
+	z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+	z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+	return z ^ (z >> 31);
+    }
+
+    // hash mapped to [0, n) without division
+    static uint64_t reduce(uint64_t h, uint64_t n) {
+	return uint64_t((unsigned __int128)h * n >> 64);
+    }
+
+    uint64_t rank(uint64_t bit) const {
+	const uint64_t word = bit/64;
+	uint64_t r = ranks[word/RANK_WORDS];
+	for (uint64_t w=word/RANK_WORDS*RANK_WORDS; w<word; w++)
+	    r += __builtin_popcountll(bits[w]);
+	return r + __builtin_popcountll(bits[word] & ((1ULL << bit%64) - 1));
+    }
+public:
+    // keys must be distinct
+    void build(std::vector<uint64_t> keys);
+
+    uint64_t size() const { return num_keys; }
+    uint64_t memory_bytes() const {
+	return (levels.size()*2 + bits.size() + ranks.size() + fallback.size()) * sizeof(uint64_t);
+    }
+
+    uint64_t lookup(uint64_t key) const {
+	for (size_t i=0; i<levels.size(); i++) {
+	    const uint64_t bit = levels[i].first_bit + reduce(hash(key, i), levels[i].num_bits);
+	    if (bits[bit/64] >> bit%64 & 1)
+		return rank(bit);
+	}
+	return num_keys - fallback.size() +
+	    (std::lower_bound(fallback.begin(), fallback.end(), key) - fallback.begin());
+    }
+
+    // Abort on I/O errors.
+    void write(FILE *fp) const;
+    void read(FILE *fp);
+};
+
+#endif
@@ -0,0 +1,857 @@
+// Copyright (C) 2016  Sami Liedes
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#include "Pos.hpp"
+#include "MoveScores.hpp"
+#include "binom.hpp"
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+
+using std::array;
+using std::cerr;
+using std::endl;
+using std::ostream;
+using std::string;
+using std::stringstream;
+
+static constexpr bool DEBUG = true;
+
+Compact_tab ranks_tab;
+
+Compact_tab *Compact_tab::instance = nullptr;
+
+Compact_tab::Compact_tab() {
+    instance = this;
+
+    init_binom();
+
+    int p = 0;
+    tab[p++] = 0;
+    for (int white=0; white<=N; white++)
+	for (int black=0; black<=N; black++) {
+	    if (white == 0 && black == 0)
+		continue;
+	    // cout << "[" << p-1 << "]: " << white << "+" << black << ": "
+	    // 	 << binom(NUM_ISQ, white) * binom(NUM_ISQ, black) * 2 << endl;
+	    tab[p] = tab[p-1] + binom(NUM_ISQ, white) * binom(NUM_ISQ, black) * 2 * (N+1);
+	    p++;
+	}
+    assert(p == SIZE);
+    assert(tab[p-1] >> 62 == 0);
+}
+
+// check if a hypothetical pawn at a square is unstoppable
+bool Pos::is_unstoppable(int s) const {
+    int file = s%N;
+    if (file != 0 && file != N-1) {
+	if (turn == 1) {
+	    for (int s2=s+N; s2<NUM_ISQ; s2+=N)
+		if (sq[s2-1] != 0 || sq[s2] != 0 || sq[s2+1] != 0)
+		    return false;
+	} else
+	    for (int s2=s-N; s2>=0; s2-=N)
+		if (sq[s2-1] != 0 || sq[s2] != 0 || sq[s2+1] != 0)
+		    return false;
+    } else {
+	int othersq;
+	if (file == 0)
+	    othersq = 1;
+	else
+	    othersq = -1;
+	if (turn == 1) {
+	    for (int s2=s+N; s2<NUM_ISQ; s2+=N)
+		if (sq[s2] != 0 || sq[s2+othersq] != 0)
+		    return false;
+	} else
+	    for (int s2=s-N; s2>=0; s2-=N)
+		if (sq[s2] != 0 || sq[s2+othersq] != 0)
+		    return false;
+    }
+    return true;
+}
+
+bool Pos::is_horiz_symmetric() const {
+    int left = 0, right = N-1;
+
+    while (left < right) {
+	for (int i=0; i<NUM_ISQ; i+=N)
+	    if (sq[left+i] != sq[right+i])
+		return false;
+	left++;
+	right--;
+    }
+    return true;
+}
+
+void Pos::horiz_mirror_board() {
+    int left = 0, right = N-1;
+
+    while (left < right) {
+	for (int i=0; i<NUM_ISQ; i+=N) {
+	    int tmp = sq[left+i];
+	    sq[left+i] = sq[right+i];
+	    sq[right+i] = tmp;
+	}
+	left++;
+	right--;
+    }
+
+    if (ep_file != -1)
+	ep_file = N-1-ep_file;
+
+    horiz_flipped = !horiz_flipped;
+    //check_sanity();
+}
+
+void Pos::canonize() {
+    // Canonize so that white is always to move
+    if (turn == -1) {
+	turn = 1;
+	canonized_player_flip = -canonized_player_flip;
+	for (int from=0, to=NUM_ISQ-1; from < to; from++, to--) {
+	    int tmp = sq[from];
+	    sq[from] = -sq[to];
+	    sq[to] = -tmp;
+	}
+	if (NUM_ISQ%2 == 1)
+	    sq[NUM_ISQ/2] = -sq[NUM_ISQ/2];
+	int tmp = num_white;
+	num_white = num_black;
+	num_black = tmp;
+	if (ep_file != -1)
+	    ep_file = N-1-ep_file;
+	//check_sanity();
+    }
+
+    // Now possibly mirror the board horizontally
+    bool horiz_done = false;
+    for (int y=0; y<NUM_RANKS && !horiz_done; y++) {
+	int left = SQ(0,y);
+	int right = left+N-1;
+	while (left < right) {
+	    if (sq[left] < sq[right]) {
+		horiz_mirror_board();
+		horiz_done = true;
+		break;
+	    } else if (sq[left] > sq[right]) {
+		horiz_done = true;
+		break;
+	    } else {
+		left++;
+		right--;
+	    }
+	}
+    }
+}
+
+ostream &operator<<(ostream &os, const Pos::Move &move) {
+    os << sqname(move.from);
+    if (move.replacing)
+	os << "x";
+    os << sqname(move.to);
+    return os;
+}
+
+void Pos::do_move(const Move &move) {
+    assert(num_white >= 0 && num_black >= 0);
+
+    assert(sq[move.from] == turn);
+    assert(sq[move.to] == move.replacing);
+    sq[move.from] = 0;
+    sq[move.to] = turn;
+
+    bool captured = false;
+
+    if (move.replacing) {
+	assert(move.replacing == -turn);
+	captured = true;
+    } else if (move.ep_square != -1) {
+	assert(sq[move.ep_square] == -turn);
+	sq[move.ep_square] = 0;
+	captured = true;
+    }
+
+    if (captured) {
+	if (turn == 1)
+	    num_black--;
+	else
+	    num_white--;
+    }
+
+    assert(ep_file == move.old_ep_file);
+    ep_file = move.new_ep_file;
+
+    turn = -turn;
+}
+
+void Pos::undo_move(const Move &move) {
+    turn = -turn;
+    assert(sq[move.to] == turn);
+    assert(sq[move.from] == 0);
+    sq[move.from] = turn;
+    sq[move.to] = move.replacing;
+
+    bool captured = false;
+
+    if (move.replacing) {
+	assert(move.replacing == -turn);
+	captured = true;
+    } else if (move.ep_square != -1) {
+	assert(sq[move.ep_square] == 0);
+	sq[move.ep_square] = -turn;
+	captured = true;
+    }
+
+    if (captured) {
+	if (turn == 1)
+	    num_black++;
+	else
+	    num_white++;
+    }
+
+    assert(ep_file == move.new_ep_file);
+    ep_file = move.old_ep_file;
+}
+
+int Pos::get_legal_moves(array<Pos::Move, MAX_LEGAL_MOVES> &moves) const {
+    array<int, N> positions;
+    int num_pawns = 0, num_moves = 0;
+
+    //print(cerr);
+
+    if (winner() != 0)
+	return 0;
+
+    // for (int i=0; i<MAX_LEGAL_MOVES; i++)
+    // 	moves[i].value = 999;
+
+    // try to return potentially more useful moves first
+    if (turn == -1) {
+	for (int i=0; i<NUM_ISQ; i++)
+	    if (sq[i] == turn)
+		positions[num_pawns++] = i;
+    } else {
+	for (int i=NUM_ISQ-1; i>=0; i--)
+	    if (sq[i] == turn)
+		positions[num_pawns++] = i;
+    }
+
+    assert(num_pawns <= N);
+
+    // evaluation function: sum of ranks of pawns squared +
+    // 100*(2+rank) for best unstoppable pawn
+
+    int best_unstoppable = -1, best_unstoppable_rank = -1;
+
+    for (int i=0; i<num_pawns; i++) {
+	int s = positions[i], file = s%N;
+	int file_centrality = std::min(file, N-1-file);
+	int front = s + turn*N; // sq in front of current
+	int rank = s/N;
+	if (turn == -1)
+	    rank = RANK_BLACK-rank;
+	if (sq[front] == 0) {
+	    // front square empty, add it
+	    moves[num_moves].from = s;
+	    moves[num_moves].to = front;
+	    moves[num_moves].value = rank+file_centrality;
+	    if (!MOVE_SCORES_LEARNED && rank+1 > best_unstoppable_rank &&
+		is_unstoppable(moves[num_moves].to)) {
+		best_unstoppable = num_moves;
+		best_unstoppable_rank = rank+1;
+	    }
+	    moves[num_moves++].replacing = 0;
+	    if (N >= 5 && rank == 0) {
+		// move ahead 2 squares?
+		int front2 = front + turn*N;
+		assert(front2 >= 0);
+		assert(front2 < NUM_ISQ);
+		if (sq[front2] == 0) {
+		    moves[num_moves].from = s;
+		    moves[num_moves].to = front2;
+		    moves[num_moves].value = rank+2+file_centrality;
+		    if (!MOVE_SCORES_LEARNED && rank+2 > best_unstoppable_rank &&
+			is_unstoppable(moves[num_moves].to)) {
+			best_unstoppable = num_moves;
+			best_unstoppable_rank = rank+2;
+		    }
+		    // if there's something that can capture this, mark file as en passant
+		    if ((file != 0 && sq[front2-1] == -turn) ||
+			(file != N-1 && sq[front2+1] == -turn))
+			moves[num_moves].new_ep_file = file;
+		    moves[num_moves++].replacing = 0;
+		}
+	    }
+	}
+	if (file != 0 && sq[front-1] == -turn) {
+	    // may capture to left
+	    moves[num_moves].from = s;
+	    moves[num_moves].to = front-1;
+	    moves[num_moves].value = rank+file_centrality;
+	    moves[num_moves].value += (NUM_RANKS-rank)*(NUM_RANKS-rank) + 1;
+	    if (!MOVE_SCORES_LEARNED && rank+1 > best_unstoppable_rank &&
+		is_unstoppable(moves[num_moves].to)) {
+		best_unstoppable = num_moves;
+		best_unstoppable_rank = rank+1;
+	    }
+	    moves[num_moves++].replacing = -turn;
+	}
+	if (file != N-1 && sq[front+1] == -turn) {
+	    // may capture to right
+	    moves[num_moves].from = s;
+	    moves[num_moves].to = front+1;
+	    moves[num_moves].value = rank+file_centrality;
+	    moves[num_moves].value += (NUM_RANKS-rank)*(NUM_RANKS-rank) + 1;
+	    if (!MOVE_SCORES_LEARNED && rank+1 > best_unstoppable_rank &&
+		is_unstoppable(moves[num_moves].to)) {
+		best_unstoppable = num_moves;
+		best_unstoppable_rank = rank+1;
+	    }
+	    moves[num_moves++].replacing = -turn;
+	}
+	if (rank == EP_RANK_BLACK) { // relative rank, so the same for both
+	    if (file != 0 && ep_file == file-1) {
+		// may capture en passant to left
+		assert(sq[s-1] == -turn);
+		assert(sq[front-1] == 0);
+		moves[num_moves].from = s;
+		moves[num_moves].to = front-1;
+		moves[num_moves].value = rank+file_centrality;
+		moves[num_moves].value += (NUM_RANKS-rank+1)*(NUM_RANKS-rank+1)+1;
+		if (!MOVE_SCORES_LEARNED && rank+1 > best_unstoppable_rank &&
+		    is_unstoppable(moves[num_moves].to)) {
+		    best_unstoppable = num_moves;
+		    best_unstoppable_rank = rank+1;
+		}
+		assert(sq[moves[num_moves].to] == 0);
+		moves[num_moves].ep_square = s-1;
+		moves[num_moves++].replacing = 0;
+	    }
+	    if (file != N-1 && ep_file == file+1) {
+		// may capture en passant to right
+		assert(sq[s+1] == -turn);
+		assert(sq[front+1] == 0);
+		moves[num_moves].from = s;
+		moves[num_moves].to = front+1;
+		moves[num_moves].value = rank+file_centrality;
+		moves[num_moves].value += (NUM_RANKS-rank+1)*(NUM_RANKS-rank+1)+1;
+		if (!MOVE_SCORES_LEARNED && rank+1 > best_unstoppable_rank &&
+		    is_unstoppable(moves[num_moves].to)) {
+		    best_unstoppable = num_moves;
+		    best_unstoppable_rank = rank+1;
+		}
+		moves[num_moves].ep_square = s+1;
+		moves[num_moves++].replacing = 0;
+	    }
+	}
+    }
+
+    assert(num_moves <= MAX_LEGAL_MOVES);
+
+    if (MOVE_SCORES_LEARNED) {
+	for (int i=0; i<num_moves; i++) {
+	    const MoveFeatures f = move_features(moves[i]);
+	    moves[i].value = MOVE_SCORES[f.kind][f.rank][f.file_centrality][f.unstoppable];
+	}
+    } else if (best_unstoppable != -1)
+	moves[best_unstoppable].value += 100*(2+best_unstoppable_rank);
+
+    for (Move &m : moves)
+	m.old_ep_file = ep_file;
+
+    return num_moves;
+}
+
+Pos::MoveFeatures Pos::move_features(const Move &m) const {
+    MoveFeatures f;
+    if (m.ep_square != -1)
+	f.kind = EN_PASSANT;
+    else if (m.replacing != 0)
+	f.kind = CAPTURE;
+    else if (std::abs(m.to - m.from) == 2*N)
+	f.kind = DOUBLE_PUSH;
+    else
+	f.kind = PUSH;
+    f.rank = m.from/N;
+    if (turn == -1)
+	f.rank = RANK_BLACK-f.rank;
+    const int file = m.from%N;
+    f.file_centrality = std::min(file, N-1-file);
+    f.unstoppable = is_unstoppable(m.to);
+    return f;
+}
+
+int Pos::get_unmoves(array<Pos::Move, MAX_UNMOVES> &unmoves) const {
+    count_pieces();
+
+    // the player who made the last move, and its forward direction
+    const int prev_turn = -turn;
+    const int forward = prev_turn*N;
+    const int start_rank = prev_turn == 1 ? RANK_WHITE : RANK_BLACK;
+    const int double_rank = prev_turn == 1 ? EP_RANK_WHITE : EP_RANK_BLACK;
+    // en passant captures are made from the opponent's double step rank
+    const int ep_capture_rank = prev_turn == 1 ? EP_RANK_BLACK : EP_RANK_WHITE;
+    const bool can_uncapture = (turn == 1 ? num_white : num_black) < N;
+
+    array<Move, 6*N> cands;
+    int num_cands = 0;
+    auto add_cand = [&](int from, int to, int replacing, int ep_square, int new_ep_file,
+			int old_ep_file) {
+	Move &m = cands[num_cands++];
+	m.from = from;
+	m.to = to;
+	m.replacing = replacing;
+	m.value = 0;
+	m.ep_square = ep_square;
+	m.new_ep_file = new_ep_file;
+	m.old_ep_file = old_ep_file;
+    };
+
+    for (int s=0; s<NUM_ISQ; s++) {
+	if (sq[s] != prev_turn || s/N == start_rank)
+	    continue;
+	const int file = s%N, behind = s-forward;
+	if (ep_file == -1) {
+	    if (sq[behind] == 0)
+		add_cand(behind, s, 0, -1, -1, -1);
+	    for (int df=-1; df<=1; df+=2) {
+		if (file+df < 0 || file+df >= N || sq[behind+df] != 0 || !can_uncapture)
+		    continue;
+		add_cand(behind+df, s, turn, -1, -1, -1);
+		// the pawn captured en passant must have moved through s
+		if ((behind+df)/N == ep_capture_rank && sq[behind] == 0 && sq[s+forward] == 0)
+		    add_cand(behind+df, s, 0, behind, -1, file);
+	    }
+	}
+	if (N >= 5 && s/N == double_rank && sq[behind] == 0 && sq[behind-forward] == 0) {
+	    // the double step gave en passant iff it could be captured
+	    const bool capturable = (file != 0 && sq[s-1] == turn) ||
+		(file != N-1 && sq[s+1] == turn);
+	    if ((capturable ? file : -1) == ep_file)
+		add_cand(behind-forward, s, 0, -1, ep_file, -1);
+	}
+    }
+
+    int num_unmoves = 0;
+    for (int i=0; i<num_cands; i++) {
+	Move &m = cands[i];
+	Pos prev(*this);
+	prev.undo_move(m);
+	if (prev.winner() != 0)
+	    continue; // the game would already have been over
+	unmoves[num_unmoves++] = m;
+	if (m.ep_square != -1)
+	    continue; // en passant state is known
+	for (int f=0; f<N && N>=5; f++)
+	    if (prev.is_ep_possible(f)) {
+		unmoves[num_unmoves] = m;
+		unmoves[num_unmoves++].old_ep_file = f;
+	    }
+    }
+    assert(num_unmoves <= MAX_UNMOVES);
+    return num_unmoves;
+}
+
+int Pos::winner() const {
+    int base;
+
+    assert(num_white >= 0 && num_black >= 0);
+
+    if (num_white == 0) {
+	assert(num_black > 0);
+	return -1; /* *canonized_player_flip;*/
+    } else if (num_black == 0)
+	return 1; /* canonized_player_flip; */
+
+    if (turn == 1)
+	base = SQ(0, NUM_RANKS-1);
+    else {
+	assert(turn == -1);
+	base = SQ(0, 0);
+    }
+    for (int i=0; i<N; i++)
+	if (sq[base+i] == turn)
+	    return turn; /**canonized_player_flip;*/
+    return 0;
+}
+
+int Pos::get_progress() const {
+    count_pieces();
+    int progress = NUM_RANKS*(2*N - num_white - num_black);
+    for (int i=0; i<NUM_ISQ; i++)
+	if (sq[i] == 1)
+	    progress += i/N - RANK_WHITE;
+	else if (sq[i] == -1)
+	    progress += RANK_BLACK - i/N;
+    assert(progress <= MAX_PROGRESS);
+    return progress;
+}
+
+bool Pos::operator==(const Pos &a) const {
+    if (turn != a.turn)
+	return false;
+
+    for (int i=0; i<NUM_ISQ; i++)
+	if (sq[i] != a.sq[i])
+	    return false;
+
+    if (ep_file != a.ep_file)
+	return false;
+
+    return true;
+}
+
+void Pos::force_count_pieces() const {
+    num_white = num_black = 0;
+    for (int i=0; i<NUM_ISQ; i++)
+	if (sq[i] == -1)
+	    num_black++;
+	else if (sq[i] == 1)
+	    num_white++;
+	else
+	    assert(sq[i] == 0);
+
+    if (num_white > N) {
+	cerr << "White has " << num_white << " pawns (>N)!" << endl;
+	this->print(cerr);
+	abort();
+    }
+    else if (num_black > N) {
+	cerr << "Black has" << num_black << " pawns (>N)!" << endl;
+	this->print(cerr);
+	abort();
+    }
+}
+
+Pos::Pos()
+    : turn(1)
+    , canonized_player_flip(1)
+    , horiz_flipped(false)
+    , ep_file(-1)
+{
+    for (int i=0; i<NUM_ISQ; i++)
+	sq[i] = 0;
+
+    for (int i=0; i<N; i++) {
+	sq[SQ(i, RANK_WHITE)] = 1;
+	sq[SQ(i, RANK_BLACK)] = -1;
+    }
+
+    count_pieces();
+}
+
+pos_t Pos::pack() const {
+    count_pieces();
+    uint64_t base = ranks_tab.base(num_white, num_black);
+    array<array<int, NUM_ISQ>, 3> squares; // black, empty, white
+    array<int, 3> num_squares{{0}};
+
+    for (int i=0; i<NUM_ISQ; i++) {
+	//assert(sq[i] >= -1 && sq[i] <= 1);
+	squares[sq[i]+1][num_squares[sq[i]+1]++] = i;
+    }
+    int num_white = num_squares[2], num_black = num_squares[0];
+
+    uint64_t whites_rank = rank_combination(squares[2].data(), num_white);
+    uint64_t blacks_rank = rank_combination(squares[0].data(), num_black);
+
+    uint64_t offset = whites_rank;
+    offset = offset * binom(NUM_ISQ, num_black) + blacks_rank;
+    offset = offset * 2 + (turn == -1);
+    offset = offset * (N+1) + ep_file + 1;
+
+    bool error = false;
+
+    if (DEBUG) {
+	if (num_white != N || num_black != N) {
+	    uint64_t base_range = ranks_tab[ranks_tab.find(base)+1]-ranks_tab[ranks_tab.find(base)];
+	    if (offset >= base_range) {
+		cerr << "pack error: offset >= base_range." << endl;
+		error = true;
+	    }
+	}
+    }
+
+    if (ranks_tab.find(base + offset) != num_white*(N+1)+num_black-1) {
+	cerr << "pack error: wrong index" << endl;
+	error = true;
+    }
+
+    if (error) {
+	print(cerr);
+	cerr << "base = " << base << endl;
+	cerr << "offset = " << offset << endl;
+	cerr << "whites_rank = " << whites_rank << endl;
+	cerr << "blacks_rank = " << blacks_rank << endl;
+	cerr << "num_white*(N+1)+num_black = " << num_white*(N+1)+num_black << endl;
+	cerr << "ranks_tab.find(base) = " << ranks_tab.find(base) << endl;
+	cerr << "ranks_tab@base = " << ranks_tab[ranks_tab.find(base)] << endl;
+	cerr << "base_range = " << ranks_tab[ranks_tab.find(base)+1]-ranks_tab[ranks_tab.find(base)] << endl;
+	cerr << "ranks_tab.find(base + offset) = index " << ranks_tab.find(base+offset) << endl;
+	cerr << "ranks_tab.find(base + offset) = " << ranks_tab[ranks_tab.find(base+offset)] << endl;
+	abort();
+    }
+    return base + offset;
+}
+
+Pos::Pos(pos_t compact)
+    : canonized_player_flip(1)
+    , horiz_flipped(false)
+{
+    clear();
+
+    uint64_t idx = ranks_tab.find(compact);
+    assert(ranks_tab[idx] <= compact);
+    uint64_t base = ranks_tab[idx];
+    uint64_t offset = compact-base;
+
+    num_black = (idx+1)%(N+1);
+    num_white = (idx+1)/(N+1);
+
+    ep_file = (offset % (N+1)) - 1;
+    offset /= N+1;
+
+    if (offset % 2)
+	turn = -1;
+    else
+	turn = 1;
+    offset /= 2;
+
+    uint64_t b = binom(NUM_ISQ, num_black);
+    uint64_t blacks_rank = offset%b;
+    uint64_t whites_rank = offset/b;
+
+    array<int, N> squares;
+    unrank_combination(squares.data(), num_white, whites_rank);
+    for (int i=0; i<num_white; i++) {
+	assert(squares[i] >= 0);
+	assert(squares[i] < NUM_ISQ);
+	sq[squares[i]] = 1;
+    }
+
+    unrank_combination(squares.data(), num_black, blacks_rank);
+    for (int i=0; i<num_black; i++) {
+	assert(squares[i] >= 0);
+	assert(squares[i] < NUM_ISQ);
+	sq[squares[i]] = -1;
+    }
+
+}
+
+
+// mainly check that no player has more than N pawns
+void Pos::check_sanity() {
+    assert(turn == -1 || turn == 1);
+    assert(num_white >= 0 && num_black >= 0);
+
+    int s = 0;
+    for (int i=0; i<NUM_ISQ; i++) {
+	if (sq[i] == 1)
+	    s += i/N;
+	else if (sq[i] == -1)
+	    s += (NUM_RANKS-1-i/N);
+    }
+}
+
+bool Pos::is_valid() const {
+    Pos p(*this);
+    p.force_count_pieces();
+    if (p.num_white != num_white || p.num_black != num_black)
+	return false; // pawns on the same square
+
+    if (ep_file == -1)
+	return true;
+    if (N < 5)
+	return false;
+    return is_ep_possible(ep_file);
+}
+
+bool Pos::is_ep_possible(int file) const {
+    // the pawn of the player not in turn must have just moved two
+    // squares, and something must be able to capture it
+    const int prev_turn = -turn;
+    const int s = SQ(file, prev_turn == 1 ? EP_RANK_WHITE : EP_RANK_BLACK);
+    if (sq[s] != prev_turn || sq[s-prev_turn*N] != 0 || sq[s-2*prev_turn*N] != 0)
+	return false;
+    return (file != 0 && sq[s-1] == turn) || (file != N-1 && sq[s+1] == turn);
+}
+
+bool Pos::is_canonical() const {
+    if (turn != 1)
+	return false;
+    Pos p(*this);
+    p.canonize();
+    return p == *this;
+}
+
+ostream &Pos::print(ostream &str) const {
+    array<char, N*2+2> delim;
+
+    for (int i=0; i<N; i++) {
+	delim[i*2] = '+';
+	delim[i*2+1] = '-';
+    }
+    delim[N*2] = '+';
+    delim[N*2+1] = 0;
+
+    for (int y=N-1; y >= 0; y--) {
+	str << delim.data() << "\n";
+	str << "|";
+	for (int x=0; x < N; x++) {
+	    if (y == 0 || y == N-1)
+		str << " ";
+	    else if (y > 0 && y < N-1) {
+		int t = sq[SQ(x, y-1)];
+		assert(t == 0 || t == -1 || t == 1);
+		str << "o x"[t+1];
+	    }
+	    str << "|";
+	}
+	if (y == 0)
+	    str << "   " << player_name(turn) << " to move";
+	str << "\n";
+    }
+    str << delim.data() << "\n";
+    return str;
+}
+
+void Pos::clear() {
+    for (int i=0; i<NUM_ISQ; i++)
+	sq[i] = 0;
+    num_white = num_black = 0;
+}
+
+bool Pos::parse(const string &s) {
+    std::istringstream in(s);
+    string board, side, ep;
+    if (!(in >> board >> side >> ep))
+	return false;
+
+    clear();
+    canonized_player_flip = 1;
+    horiz_flipped = false;
+    int rank = NUM_RANKS-1, file = 0, nw = 0, nb = 0;
+    for (char c : board) {
+	if (c == '/') {
+	    if (file != N || rank == 0)
+		return false;
+	    rank--;
+	    file = 0;
+	} else if (c >= '1' && c <= '9') {
+	    file += c-'0';
+	    if (file > N)
+		return false;
+	} else if ((c == 'P' || c == 'p') && file < N) {
+	    sq[SQ(file++, rank)] = c == 'P' ? 1 : -1;
+	    (c == 'P' ? nw : nb)++;
+	} else
+	    return false;
+    }
+    if (rank != 0 || file != N || nw > N || nb > N)
+	return false;
+
+    if (side == "w")
+	turn = 1;
+    else if (side == "b")
+	turn = -1;
+    else
+	return false;
+
+    if (ep == "-")
+	ep_file = -1;
+    else if (ep.size() == 1 && ep[0] >= 'a' && ep[0] < 'a'+N)
+	ep_file = ep[0]-'a';
+    else
+	return false;
+
+    force_count_pieces();
+    return is_valid();
+}
+
+void Pos::random_position() {
+    int w = 0, b = 0;
+    do {
+	int r = rand();
+	w = r % N;
+	r /= N;
+	b = r%N;
+    } while (w == 0 && b == 0);
+    random_position(w, b);
+}
+
+void Pos::random_position(int nw, int nb) {
+    assert(nw >= 0 && nw <= N);
+    assert(nb >= 0 && nb <= N);
+    assert(nw != 0 || nb != 0);
+    clear();
+    num_white = nw;
+    num_black = nb;
+    while (nw) {
+	int x = rand()%NUM_ISQ;
+	if (sq[x] == 0) {
+	    sq[x] = 1;
+	    nw--;
+	}
+    }
+
+    while (nb) {
+	int x = rand()%NUM_ISQ;
+	if (sq[x] == 0) {
+	    sq[x] = -1;
+	    nb--;
+	}
+    }
+
+    if (rand() % 2)
+	turn = -1;
+    else
+	turn = 1;
+
+    // now check if any of the pawns not in turn could be just moved
+    // two spaces, and possibly mark one of them as en passant
+    const int prev_turn = -turn;
+    const bool prev_was_white = (turn == -1);
+    const int ep_rank = prev_was_white ? EP_RANK_WHITE : EP_RANK_BLACK;
+    const int first_ep_square = SQ(0, ep_rank);
+
+    ep_file = -1;
+
+    int ep_files[N], ep_count=0;
+    int ep_backward = turn*N;
+    for (int i=0; i<N; i++) {
+	if (sq[first_ep_square+i] == prev_turn) {
+	    if (((i != 0 && sq[first_ep_square+i-1] == turn) ||
+		 (i != N-1 && sq[first_ep_square+i+1] == turn)) &&
+		sq[first_ep_square+i+ep_backward] == 0 &&
+		sq[first_ep_square+i+2*ep_backward] == 0)
+		ep_files[ep_count++] = i; // something can take this
+	}
+    }
+
+    if (ep_count == 0)
+	return;
+
+    int ep = rand() % (ep_count + 1);
+    if (ep == ep_count)
+	ep_file = -1; // no en passant this time
+    else
+	ep_file = ep_files[ep];
+}
@@ -0,0 +1,297 @@
+// Copyright (C) 2016  Sami Liedes
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#ifndef Pos_hpp
+#define Pos_hpp
+
+#include "binom.hpp"
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+// Board size; build with e.g. -DBOARD_N=6 for a smaller board.
+#ifndef BOARD_N
+#define BOARD_N 8
+#endif
+
+static constexpr int N = BOARD_N;
+
+// number of internal ranks (i.e. those on which pawns can be
+// without the game being over)
+static constexpr int NUM_RANKS = N-2;
+
+// number of internal squares
+static constexpr int NUM_ISQ = N*NUM_RANKS;
+
+// starting ranks
+static constexpr int RANK_WHITE = 0;
+static constexpr int RANK_BLACK = NUM_RANKS-1;
+
+// a pawn must be in one of these ranks to even be candidate for en passant
+static constexpr int EP_RANK_WHITE = RANK_WHITE+2;
+static constexpr int EP_RANK_BLACK = RANK_BLACK-2;
+
+// tighter limit? N*2 is not enough
+static constexpr int MAX_LEGAL_MOVES = N*3;
+
+// Each pawn can have been moved to its square in at most 6 ways, and
+// the position before that can have en passant on any file or none.
+static constexpr int MAX_UNMOVES = 6*N*(N+1);
+
+// Pos::get_progress() grows by at least 1 and at most this in every move
+static constexpr int MAX_PROGRESS_STEP = NUM_RANKS+1;
+static constexpr int MAX_PROGRESS = 2*N*NUM_RANKS;
+
+// compactly represented position
+typedef uint64_t pos_t;
+
+static inline int flip_horiz_sq(int sq) {
+    int rank = sq/N, file = sq%N;
+    return rank*N + (N-1-file);
+}
+
+static inline const char *player_name(int player) {
+    if (player == 1)
+	return "White";
+    else if (player == -1)
+	return "Black";
+    else
+	abort();
+}
+
+static inline void assert_valid_sq(int x, int y) {
+    assert(x >= 0);
+    assert(x < N);
+    assert(y >= 0);
+    assert(y < N-2);
+}
+
+static inline int SQ(int x, int y) {
+    assert_valid_sq(x, y);
+    return y*N+x;
+}
+
+static inline std::string sqname(int x, int y) {
+    assert_valid_sq(x, y);
+    std::stringstream sb;
+    assert(N < 26);
+    sb << (char)('a'+x);
+    sb << 2+y;
+    return sb.str();
+}
+
+static inline std::string sqname(int sq) {
+    assert(sq >= 0);
+    assert(sq < NUM_ISQ);
+    return sqname(sq%N, sq/N);
+}
+
+// Singleton
+class Compact_tab {
+private:
+    static Compact_tab *instance;
+    static constexpr int SIZE = (N+1)*(N+1);
+    std::array<uint64_t, SIZE> tab;
+public:
+    Compact_tab();
+    uint64_t operator[](int n) const {
+	assert(n >= 0);
+	assert(n < SIZE);
+	return tab[n];
+    }
+    uint64_t base(int nwhite, int nblack) const {
+	assert(nwhite >= 0 && nwhite <= N);
+	assert(nblack >= 0 && nblack <= N);
+	assert(nwhite != 0 || nblack != 0);
+	return tab[nwhite*(N+1)+nblack-1];
+    }
+    // number of indices in the class
+    uint64_t size(int nwhite, int nblack) const {
+	assert(nwhite >= 0 && nwhite <= N);
+	assert(nblack >= 0 && nblack <= N);
+	assert(nwhite != 0 || nblack != 0);
+	return tab[nwhite*(N+1)+nblack]-tab[nwhite*(N+1)+nblack-1];
+    }
+    int num_white(int idx) const { return (idx+1)/(N+1); }
+    int num_black(int idx) const { return (idx+1)%(N+1); }
+    // returns the index of the last element <= n
+    int find(uint64_t n) const {
+	return std::upper_bound(&tab[0], &tab[SIZE], n) - tab.begin() - 1;
+    }
+};
+
+extern Compact_tab ranks_tab;
+
+class Pos {
+    friend class ClassEnumerator;
+    friend class TightIndex;
+    std::array<int, NUM_ISQ> sq; // 1 = white, -1 = black, 0 = empty
+    int turn; // 1 = white, -1 = black
+    mutable int num_white = -1, num_black = -1; // calculated if/when needed
+    int canonized_player_flip; // -1 changed player in canonize, else 1
+    bool horiz_flipped;
+    int ep_file; // en passant; -1 = no ep
+    void force_count_pieces() const;
+    void count_pieces() const { if (num_white == -1) force_count_pieces(); }
+    void clear();
+    // check if a hypothetical pawn at a square is unstoppable
+    bool is_unstoppable(int sq) const;
+    // could the player not in turn just have moved two squares on the
+    // file so that the player in turn can capture en passant
+    bool is_ep_possible(int file) const;
+public:
+    struct Move {
+	// 'replacing' = the contents of the square moved to
+	// (so this information is enough to undo the move).
+	int from, to, replacing, value;
+	int new_ep_file, old_ep_file, ep_square;
+
+	// Move(int from, int to, int replacing, int value, int ep_square=-1)
+	//     : from(from), to(to), replacing(replacing), value(value), ep_square(ep_square)
+	// {}
+
+	Move() : from(-1), to(-1), replacing(-100), value(-9999999), new_ep_file(-1),
+		 old_ep_file(-9999999), ep_square(-1) {}
+
+	// used to remove symmetric moves if Pos::is_horiz_symmetric() returns true
+	bool is_from_right_half() const { return from >= (N+1)/2; }
+
+	Move decanonize(bool black, bool flip_horiz) const {
+	    Move m(*this);
+	    int from = this->from, to = this->to, replacing = this->replacing;
+	    int old_ep_f = old_ep_file, new_ep_f = new_ep_file, ep_sq = ep_square;
+	    if (black) {
+		from = NUM_ISQ-1-from;
+		to = NUM_ISQ-1-to;
+		if (old_ep_f != -1)
+		    old_ep_f = N-1-old_ep_f;
+		if (new_ep_f != -1)
+		    new_ep_f = N-1-new_ep_f;
+		if (ep_sq != -1)
+		    ep_sq = NUM_ISQ-1-ep_sq;
+		replacing = -replacing;
+	    }
+	    if (flip_horiz) {
+		from = flip_horiz_sq(from);
+		to = flip_horiz_sq(to);
+		if (old_ep_f != -1)
+		    old_ep_f = N-1-old_ep_f;
+		if (new_ep_f != -1)
+		    new_ep_f = N-1-new_ep_f;
+		if (ep_sq != -1)
+		    ep_sq = flip_horiz_sq(ep_sq);
+	    }
+	    m.from = from;
+	    m.to = to;
+	    m.replacing = replacing;
+	    m.old_ep_file = old_ep_f;
+	    m.new_ep_file = new_ep_f;
+	    m.ep_square = ep_sq;
+	    return m;
+	}
+
+	std::string name() const {
+	    int from_file = from%N, from_rank = from/N,
+		to_file = to%N, to_rank = to/N;
+	    assert(from_file >= 0);
+	    assert(from_file < N);
+	    assert(from_rank >= 0);
+	    assert(from_rank < NUM_RANKS);
+
+	    std::stringstream ss;
+	    ss << ('a'+from_file) << ('1'+from_rank);
+	    if (replacing)
+		ss << 'x';
+	    else if (ep_square != -1)
+		ss << "(ep)";
+	    ss << ('a'+to_file) << ('1'+to_rank);
+	    return ss.str();
+	}
+    };
+
+    Pos(); // initial position
+    Pos(pos_t);
+    pos_t pack() const;
+    void check_sanity();
+    // Not every pos_t is a position: pawns may overlap and the en
+    // passant file may be impossible. Only valid for Pos(pos_t).
+    bool is_valid() const;
+    // white to move and not changed by canonize()
+    bool is_canonical() const;
+    std::ostream &print(std::ostream &str) const;
+    void random_position();
+    void random_position(int nwhites, int nblacks);
+    // Sets the position from a string like "8/8/3p4/8/2P5/8 w -": the
+    // internal ranks from the top down separated by '/', with 'P' for
+    // white pawns, 'p' for black pawns and digits for runs of empty
+    // squares, then the side to move (w or b) and the en passant file
+    // (a letter) or '-'. Returns false if the string is malformed or
+    // the position is not valid.
+    bool parse(const std::string &s);
+    int get_turn() const { return turn*canonized_player_flip; }
+    void canonize();
+    void horiz_mirror_board();
+    bool is_horiz_symmetric() const;
+
+    int winner() const; // -1 if won by black, 1 if by white, 0 otherwise
+    // Total advancement of all pawns, with each captured pawn counting
+    // as NUM_RANKS. Every move increases it, so the game graph is a DAG.
+    int get_progress() const;
+    int get_num_white() const { count_pieces(); return num_white; }
+    int get_num_black() const { count_pieces(); return num_black; }
+    int get_canonize_flip() const { return canonized_player_flip; }
+    bool get_horiz_flipped() const { return horiz_flipped; }
+
+    // Returns count. The moves are not sorted; Move::value is a static
+    // estimate of how good each is, which the search orders them by
+    // (see MoveOrdering).
+    int get_legal_moves(std::array<Move, MAX_LEGAL_MOVES> &moves) const;
+
+    // What Move::value is looked up by when there is a table learned
+    // by movestats for the board size (see MoveScores.hpp).
+    enum MoveKind { PUSH, DOUBLE_PUSH, CAPTURE, EN_PASSANT, NUM_MOVE_KINDS };
+    struct MoveFeatures {
+	int kind; // MoveKind
+	int rank; // of the pawn moved, counted from its own side
+	int file_centrality; // distance of the file from the edge
+	bool unstoppable; // is_unstoppable() on the square moved to
+    };
+    // m must be a legal move in this position.
+    MoveFeatures move_features(const Move &m) const;
+
+    // Retrograde move generation: returns the moves that lead to this
+    // position from a legal, not yet decided position, such that
+    // undo_move() gives the previous position and do_move() on that
+    // gives this one again. Captures, including en passant, restore
+    // the captured pawn. Every possible en passant state of the
+    // previous position is a separate move. To get the canonical
+    // predecessors, canonize() the undone positions.
+    int get_unmoves(std::array<Move, MAX_UNMOVES> &unmoves) const;
+
+    void do_move(const Move &move);
+    void undo_move(const Move &move);
+
+    bool operator==(const Pos &) const;
+};
+
+std::ostream &operator<<(std::ostream &os, const Pos::Move &move);
+
+#endif
@@ -0,0 +1,142 @@
+// Copyright (C) 2016  Sami Liedes
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#ifndef ProgressLog_hpp
+#define ProgressLog_hpp
+
+#include "ThreadSlot.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Lock-free logging for the search threads. push() copies a fixed-size
+// record into the calling thread slot's single-producer ring and
+// returns; if the ring is full the record is dropped and counted, so
+// the cost on the search thread stays bounded. A background thread
+// drains all rings every DRAIN_INTERVAL_MS and hands the records, in
+// push order, to the sink.
+//
+// Record must be trivially copyable and have a uint64_t field seq.
+template<class Record, size_t CAPACITY = 1024>
+class ProgressLog {
+public:
+    typedef std::function<void(const std::vector<Record> &)> Sink;
+    static constexpr int DRAIN_INTERVAL_MS = 100;
+private:
+    // padded by hand, since C++14 new does not honor alignas(64)
+    struct Ring {
+	std::atomic<size_t> head{0}; // next to write; owned by producer
+	char pad1[64 - sizeof(std::atomic<size_t>)];
+	std::atomic<size_t> tail{0}; // next to read; owned by drainer
+	char pad2[64 - sizeof(std::atomic<size_t>)];
+	std::array<Record, CAPACITY> buf;
+    };
+    std::array<std::atomic<Ring *>, MAX_THREAD_SLOTS> rings;
+    std::atomic<uint64_t> next_seq{0};
+    std::atomic<uint64_t> dropped{0};
+
+    Sink sink;
+    std::thread drainer;
+    std::mutex stop_mutex;
+    std::condition_variable stop_cond;
+    bool stop_requested = false;
+
+    void drain() {
+	std::vector<Record> records;
+	for (int i=0; i<thread_slots_used(); i++) {
+	    Ring *r = rings[i].load(std::memory_order_acquire);
+	    if (!r)
+		continue;
+	    size_t tail = r->tail.load(std::memory_order_relaxed);
+	    size_t head = r->head.load(std::memory_order_acquire);
+	    for (; tail != head; tail++)
+		records.push_back(r->buf[tail%CAPACITY]);
+	    r->tail.store(tail, std::memory_order_release);
+	}
+	if (records.empty())
+	    return;
+	std::sort(records.begin(), records.end(),
+		  [](const Record &a, const Record &b) { return a.seq < b.seq; });
+	sink(records);
+    }
+
+    void run() {
+	std::unique_lock<std::mutex> guard(stop_mutex);
+	while (!stop_cond.wait_for(guard, std::chrono::milliseconds(DRAIN_INTERVAL_MS),
+				   [this] { return stop_requested; }))
+	    drain();
+	drain();
+    }
+
+    ProgressLog(const ProgressLog &);
+public:
+    ProgressLog() {
+	for (auto &r : rings)
+	    r.store(nullptr, std::memory_order_relaxed);
+    }
+    ~ProgressLog() {
+	stop();
+	for (auto &r : rings)
+	    delete r.load(std::memory_order_relaxed);
+    }
+
+    void start(Sink s) {
+	sink = s;
+	drainer = std::thread(&ProgressLog::run, this);
+    }
+
+    // Stops the background thread after writing out everything pushed so far.
+    void stop() {
+	{
+	    std::lock_guard<std::mutex> guard(stop_mutex);
+	    stop_requested = true;
+	}
+	stop_cond.notify_one();
+	if (drainer.joinable())
+	    drainer.join();
+    }
+
+    // Returns false if the record was dropped.
+    bool push(Record rec) {
+	const int slot = thread_slot();
+	Ring *r = rings[slot].load(std::memory_order_relaxed);
+	if (!r) {
+	    r = new Ring;
+	    rings[slot].store(r, std::memory_order_release);
+	}
+	size_t head = r->head.load(std::memory_order_relaxed);
+	if (head - r->tail.load(std::memory_order_acquire) == CAPACITY) {
+	    dropped.fetch_add(1, std::memory_order_relaxed);
+	    return false;
+	}
+	rec.seq = next_seq.fetch_add(1, std::memory_order_relaxed);
+	r->buf[head%CAPACITY] = rec;
+	r->head.store(head+1, std::memory_order_release);
+	return true;
+    }
+
+    uint64_t num_dropped() const { return dropped.load(std::memory_order_relaxed); }
+};
+
+#endif
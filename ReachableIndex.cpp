@@ -0,0 +1,87 @@
+// Copyright (C) 2016  Sami Liedes
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#include "ReachableIndex.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <utility>
+
+using std::cerr;
+using std::endl;
+using std::string;
+using std::vector;
+
+void ReachableIndex::init_bases() {
+    for (int c=0; c<NUM_CLASSES; c++)
+	bases[c+1] = bases[c] + hashes[c].size();
+}
+
+void ReachableIndex::build(vector<vector<pos_t>> keys) {
+    assert(keys.size() == size_t(NUM_CLASSES));
+    for (int c=0; c<NUM_CLASSES; c++)
+	hashes[c].build(std::move(keys[c]));
+    init_bases();
+}
+
+void ReachableIndex::write(const string &fname) const {
+    FILE *fp = fopen(fname.c_str(), "wb");
+    if (!fp) {
+	cerr << "Could not open " << fname << " for writing" << endl;
+	abort();
+    }
+    char magic[8];
+    strcpy(magic, REACHABLE_MAGIC);
+    const uint32_t n = N;
+    if (fwrite(magic, sizeof(magic), 1, fp) != 1 || fwrite(&n, sizeof(n), 1, fp) != 1) {
+	cerr << fname << ": short write" << endl;
+	abort();
+    }
+    for (const PerfectHash &h : hashes)
+	h.write(fp);
+    if (fclose(fp) != 0) {
+	cerr << "Failed to close " << fname << endl;
+	abort();
+    }
+}
+
+void ReachableIndex::load(const string &fname) {
+    FILE *fp = fopen(fname.c_str(), "rb");
+    if (!fp) {
+	cerr << "Could not open " << fname << endl;
+	abort();
+    }
+    char magic[8];
+    uint32_t n;
+    if (fread(magic, sizeof(magic), 1, fp) != 1 || fread(&n, sizeof(n), 1, fp) != 1 ||
+	strncmp(magic, REACHABLE_MAGIC, sizeof(magic)) != 0 || n != N) {
+	cerr << fname << ": not a reachable position index for a " << N << "x" << N
+	     << " board" << endl;
+	abort();
+    }
+    for (PerfectHash &h : hashes)
+	h.read(fp);
+    fclose(fp);
+    init_bases();
+}
+
+uint64_t ReachableIndex::memory_bytes() const {
+    uint64_t bytes = 0;
+    for (const PerfectHash &h : hashes)
+	bytes += h.memory_bytes();
+    return bytes;
+}
@@ -0,0 +1,63 @@
+// Copyright (C) 2016  Sami Liedes
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#ifndef ReachableIndex_hpp
+#define ReachableIndex_hpp
+
+#include "PerfectHash.hpp"
+#include "Pos.hpp"
+
+#include <array>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// A dense index of the positions reachable from the initial position
+// (canonized, as the search sees them), made by reachgen: a minimal
+// perfect hash of the packed positions of each material class, with
+// the classes one after the other in the order of Compact_tab.
+//
+// File layout: the magic, N as uint32_t, then the PerfectHash of each
+// class.
+
+#define REACHABLE_MAGIC "PAWNRI1"
+
+class ReachableIndex {
+    static constexpr int NUM_CLASSES = (N+1)*(N+1)-1; // as in Compact_tab
+    std::array<PerfectHash, NUM_CLASSES> hashes;
+    std::array<uint64_t, NUM_CLASSES+1> bases{{0}};
+
+    void init_bases();
+public:
+    // keys[ranks_tab.find(p)] holds position p; no duplicates.
+    void build(std::vector<std::vector<pos_t>> keys);
+
+    // Abort on errors.
+    void write(const std::string &fname) const;
+    void load(const std::string &fname);
+
+    uint64_t size() const { return bases[NUM_CLASSES]; }
+    uint64_t memory_bytes() const;
+
+    // pos must be one of the positions; anything else gets an
+    // arbitrary index.
+    uint64_t index(pos_t pos) const {
+	const int c = ranks_tab.find(pos);
+	return bases[c] + hashes[c].lookup(pos);
+    }
+};
+
+#endif
@@ -0,0 +1,87 @@
+// Copyright (C) 2016  Sami Liedes
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#ifndef ReachableTranspositionTable_hpp
+#define ReachableTranspositionTable_hpp
+
+#include "PackedResultArray.hpp"
+#include "ReachableIndex.hpp"
+#include "TranspositionTable.hpp"
+
+#include <cassert>
+#include <string>
+
+// An exact table with one slot for every position reachable from the
+// initial position, found by a ReachableIndex (made by reachgen). There
+// are no collisions and no position bits to store, so a slot is just a
+// result in a PackedResultArray.
+//
+// Only positions in the index may be probed or added, which holds for
+// the search from the initial position. load_index() must be called
+// before use.
+class ReachableTranspositionTable : public TranspositionTableBase {
+    ReachableIndex index;
+    PackedResultArray results;
+
+    static Entry entry(TpResult result) {
+	Entry e;
+	e.pos = 0;
+	e.result = static_cast<int>(result);
+	return e;
+    }
+    ReachableTranspositionTable(const ReachableTranspositionTable &);
+public:
+    ReachableTranspositionTable() {}
+
+    void load_index(const std::string &fname) {
+	index.load(fname);
+	results.resize(index.size());
+    }
+
+    size_t get_capacity() const { return results.size(); }
+    uint64_t index_bytes() const { return index.memory_bytes(); }
+    uint64_t result_bytes() const { return results.bytes(); }
+
+    bool is_empty_slot(uint64_t pos) const {
+	return results.get(index.index(pos)) == TpResult::NONE;
+    }
+
+    TP_INLINE TpResult probe(uint64_t pos) {
+	const TpResult res = results.get(index.index(pos));
+	count_probe(entry(res), 0);
+	return res;
+    }
+
+    TP_INLINE void add(uint64_t pos, TpResult result) {
+	assert(result != TpResult::NONE);
+	TpResult stored;
+	const TpResult old = results.store(index.index(pos), result, stored);
+	if (stored != result)
+	    bump(shard().merges);
+	count_store(entry(old), entry(stored));
+    }
+
+    // same interface as CachedTranspositionTable; everything is stored
+    void add(uint64_t pos, TpResult result, uint64_t /*subtree_nodes*/) { add(pos, result); }
+
+    void save(const char *fname) const { results.write(fname); }
+    void load(const char *fname) {
+	results.read(fname);
+	reset_occupancy(results.count_results());
+    }
+};
+
+#endif
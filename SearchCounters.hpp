@@ -0,0 +1,88 @@
+// Copyright (C) 2016  Sami Liedes
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#ifndef SearchCounters_hpp
+#define SearchCounters_hpp
+
+#include "ThreadSlot.hpp"
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+
+// Per-thread search counters. Each thread slot has its own cache line
+// and is only written by its owner, so counting is a plain increment;
+// totals are summed on demand by whoever wants to report them.
+class SearchCounters {
+public:
+    struct Totals {
+	uint64_t nodes = 0;
+	uint64_t tb_hits = 0; // positions resolved by the tablebases
+	uint64_t aborted_nodes = 0; // searched by threads whose result was thrown away
+	uint64_t wait_ns = 0; // waiting for a free thread to search a move
+	uint64_t best_move_hits = 0; // nodes that tried a move from BestMoveTable first
+
+	Totals &operator+=(const Totals &a) {
+	    nodes += a.nodes;
+	    tb_hits += a.tb_hits;
+	    aborted_nodes += a.aborted_nodes;
+	    wait_ns += a.wait_ns;
+	    best_move_hits += a.best_move_hits;
+	    return *this;
+	}
+	Totals operator-(const Totals &a) const {
+	    Totals t;
+	    t.nodes = nodes - a.nodes;
+	    t.tb_hits = tb_hits - a.tb_hits;
+	    t.aborted_nodes = aborted_nodes - a.aborted_nodes;
+	    t.wait_ns = wait_ns - a.wait_ns;
+	    t.best_move_hits = best_move_hits - a.best_move_hits;
+	    return t;
+	}
+    };
+
+    struct alignas(64) Slot {
+	std::atomic<uint64_t> nodes{0}, tb_hits{0};
+	std::atomic<uint64_t> aborted_nodes{0}, wait_ns{0}, best_move_hits{0};
+
+	static void bump(std::atomic<uint64_t> &c, uint64_t delta = 1) {
+	    c.store(c.load(std::memory_order_relaxed)+delta, std::memory_order_relaxed);
+	}
+	Totals totals() const {
+	    Totals t;
+	    t.nodes = nodes.load(std::memory_order_relaxed);
+	    t.tb_hits = tb_hits.load(std::memory_order_relaxed);
+	    t.aborted_nodes = aborted_nodes.load(std::memory_order_relaxed);
+	    t.wait_ns = wait_ns.load(std::memory_order_relaxed);
+	    t.best_move_hits = best_move_hits.load(std::memory_order_relaxed);
+	    return t;
+	}
+    };
+private:
+    std::array<Slot, MAX_THREAD_SLOTS> slots;
+public:
+    Slot &local() { return slots[thread_slot()]; }
+    Totals slot_totals(int slot) const { return slots[slot].totals(); }
+
+    Totals totals() const {
+	Totals t;
+	for (const Slot &s : slots)
+	    t += s.totals();
+	return t;
+    }
+};
+
+#endif
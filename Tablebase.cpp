@@ -0,0 +1,160 @@
+// Copyright (C) 2016  Sami Liedes
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#include "Tablebase.hpp"
+#include "ThreadSlot.hpp"
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+#include <zlib.h>
+
+using std::cerr;
+using std::endl;
+using std::string;
+using std::vector;
+
+static void write_or_die(FILE *fp, const void *data, size_t size, const string &fname) {
+    if (fwrite(data, 1, size, fp) != size) {
+	cerr << fname << ": short write" << endl;
+	abort();
+    }
+}
+
+void write_tablebase(const string &fname, int nw, int nb, const uint8_t *data,
+		     uint64_t block_size) {
+    assert(block_size%4 == 0);
+    FILE *fp = fopen(fname.c_str(), "wb");
+    if (!fp) {
+	cerr << "Could not open " << fname << " for writing" << endl;
+	abort();
+    }
+    TablebaseHeader header;
+    header.init(nw, nb);
+    const uint64_t packed_size = (header.count+3)/4;
+
+    if (block_size == 0) {
+	write_or_die(fp, &header, sizeof(header), fname);
+	write_or_die(fp, data, packed_size, fname);
+    } else {
+	header.flags |= TablebaseHeader::COMPRESSED;
+	header.block_size = block_size;
+	vector<uint64_t> offsets{0};
+	vector<uint8_t> compressed;
+	vector<uint8_t> buf(compressBound(block_size/4));
+	for (uint64_t i=0; i<header.num_blocks(); i++) {
+	    const uint64_t begin = i*block_size/4;
+	    const uint64_t len = std::min(packed_size, begin + block_size/4) - begin;
+	    uLongf buf_len = buf.size();
+	    if (compress2(buf.data(), &buf_len, data+begin, len, Z_BEST_COMPRESSION) != Z_OK) {
+		cerr << fname << ": compression failed" << endl;
+		abort();
+	    }
+	    compressed.insert(compressed.end(), buf.begin(), buf.begin()+buf_len);
+	    offsets.push_back(compressed.size());
+	}
+	write_or_die(fp, &header, sizeof(header), fname);
+	write_or_die(fp, offsets.data(), offsets.size()*sizeof(uint64_t), fname);
+	write_or_die(fp, compressed.data(), compressed.size(), fname);
+    }
+
+    if (fclose(fp) != 0) {
+	cerr << "Failed to close " << fname << endl;
+	abort();
+    }
+}
+
+Tablebases::Tablebases()
+    : caches(new std::array<BlockCache, MAX_THREAD_SLOTS>)
+{}
+
+Tablebases::~Tablebases() {
+    for (auto &row : files)
+	for (ClassFile &f : row)
+	    if (f.map)
+		munmap(f.map, f.map_size);
+}
+
+void Tablebases::load(const string &dir, int max_pawns) {
+    for (int nw=1; nw<=N; nw++)
+	for (int nb=1; nb<=N && nw+nb<=max_pawns; nb++) {
+	    const string fname = tablebase_filename(dir, nw, nb);
+	    int fd = open(fname.c_str(), O_RDONLY);
+	    struct stat st;
+	    if (fd < 0 || fstat(fd, &st) != 0) {
+		cerr << "Could not open tablebase " << fname << endl;
+		abort();
+	    }
+	    ClassFile &f = files[nw][nb];
+	    f.map_size = st.st_size;
+	    f.map = mmap(nullptr, f.map_size, PROT_READ, MAP_SHARED, fd, 0);
+	    close(fd);
+	    if (f.map == MAP_FAILED) {
+		cerr << "Could not map tablebase " << fname << endl;
+		abort();
+	    }
+
+	    f.header = static_cast<const TablebaseHeader *>(f.map);
+	    const uint8_t *p = static_cast<const uint8_t *>(f.map) + sizeof(TablebaseHeader);
+	    bool ok = f.map_size >= sizeof(TablebaseHeader) && f.header->matches(nw, nb);
+	    if (ok && f.header->is_compressed()) {
+		// the offset table must fit before it is read
+		ok = f.header->block_size != 0 && f.header->block_size%4 == 0;
+		const uint64_t num_blocks = ok ? f.header->num_blocks() : 0;
+		const uint64_t table_bytes = (num_blocks+1)*sizeof(uint64_t);
+		ok = ok && num_blocks < (f.map_size - sizeof(TablebaseHeader))/sizeof(uint64_t);
+		if (ok) {
+		    f.block_offsets = reinterpret_cast<const uint64_t *>(p);
+		    f.data = p + table_bytes;
+		    ok = f.block_offsets[num_blocks] ==
+			f.map_size - sizeof(TablebaseHeader) - table_bytes;
+		}
+	    } else if (ok) {
+		f.data = p;
+		ok = f.map_size == sizeof(TablebaseHeader) + (f.header->count+3)/4;
+	    }
+	    if (!ok) {
+		cerr << fname << ": not a tablebase for class " << nw << "+" << nb
+		     << " on a " << N << "x" << N << " board" << endl;
+		abort();
+	    }
+	}
+    this->max_pawns = max_pawns;
+}
+
+TpResult Tablebases::probe_compressed(const ClassFile &f, uint64_t idx) const {
+    BlockCache &c = (*caches)[thread_slot()];
+    const uint64_t block_size = f.header->block_size;
+    const uint64_t block = idx / block_size;
+    if (c.file != &f || c.block != block) {
+	c.buf.resize(block_size/4);
+	uLongf len = c.buf.size();
+	const uint8_t *src = f.data + f.block_offsets[block];
+	if (uncompress(c.buf.data(), &len, src,
+		       f.block_offsets[block+1] - f.block_offsets[block]) != Z_OK) {
+	    cerr << "Corrupt tablebase block " << block << " in class "
+		 << f.header->num_white << "+" << f.header->num_black << endl;
+	    abort();
+	}
+	c.file = &f;
+	c.block = block;
+    }
+    return get_packed_result(c.buf.data(), idx%block_size);
+}
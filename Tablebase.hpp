@@ -0,0 +1,155 @@
+// Copyright (C) 2016  Sami Liedes
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#ifndef Tablebase_hpp
+#define Tablebase_hpp
+
+#include "Pos.hpp"
+#include "TightIndex.hpp"
+#include "TranspositionTable.hpp"
+
+#include <array>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Endgame tablebases: one file per material class (num_white,
+// num_black) of Compact_tab, holding the exact result of every
+// canonical position (white to move) of the class from the point of
+// view of the side to move. The result of position p is at index
+// tight_index.index(p).
+//
+// Results are 2-bit TpResults, CURRENT_LOSS, DRAW or CURRENT_WIN, or
+// NONE for indices that are not used by positions; four per byte,
+// lowest bits first. File layout:
+//
+//   TablebaseHeader
+//   if not compressed: (count+3)/4 bytes of results
+//   if compressed: num_blocks+1 uint64_t offsets, relative to the end
+//     of the offset table, of zlib-compressed blocks, each holding the
+//     results of block_size indices (the last one possibly fewer).
+//
+// Files are mapped read-only, so processes share the page cache copy.
+
+#define TABLEBASE_MAGIC "PAWNTB3"
+
+struct TablebaseHeader {
+    char magic[8];
+    uint32_t n;
+    uint32_t num_white, num_black;
+    uint32_t flags;
+    uint64_t count; // = tight_index.size(num_white, num_black)
+    uint64_t block_size; // indices per compressed block
+
+    static constexpr uint32_t COMPRESSED = 1;
+
+    void init(int nw, int nb) {
+	memset(this, 0, sizeof(*this));
+	strcpy(magic, TABLEBASE_MAGIC);
+	n = N;
+	num_white = nw;
+	num_black = nb;
+	count = tight_index.size(nw, nb);
+    }
+
+    bool matches(int nw, int nb) const {
+	return strncmp(magic, TABLEBASE_MAGIC, sizeof(magic)) == 0 && n == N &&
+	    int(num_white) == nw && int(num_black) == nb &&
+	    count == tight_index.size(nw, nb);
+    }
+
+    bool is_compressed() const { return flags & COMPRESSED; }
+    uint64_t num_blocks() const { return (count + block_size - 1) / block_size; }
+};
+
+static inline std::string tablebase_filename(const std::string &dir, int nw, int nb) {
+    std::stringstream ss;
+    ss << dir << "/pawns" << N << "_" << nw << "_" << nb << ".tb";
+    return ss.str();
+}
+
+static inline TpResult get_packed_result(const uint8_t *data, uint64_t i) {
+    return TpResult((data[i/4] >> (i%4*2)) & 3);
+}
+
+static inline void set_packed_result(uint8_t *data, uint64_t i, TpResult r) {
+    assert(static_cast<int>(r) < 4);
+    data[i/4] = (data[i/4] & ~(3 << (i%4*2))) | static_cast<int>(r) << (i%4*2);
+}
+
+// Writes a class whose results are packed (as above) in data;
+// block_size = 0 means no compression. block_size must be a multiple of 4.
+void write_tablebase(const std::string &fname, int nw, int nb, const uint8_t *data,
+		     uint64_t block_size);
+
+// The tablebases of all classes with at most max_pawns pawns, for
+// probing during the search.
+class Tablebases {
+    struct ClassFile {
+	const TablebaseHeader *header = nullptr;
+	const uint8_t *data = nullptr; // packed results or compressed blocks
+	const uint64_t *block_offsets = nullptr;
+	void *map = nullptr;
+	size_t map_size = 0;
+    };
+
+    // most recently decompressed block, per thread slot; padded by
+    // hand, since C++14 new does not honor alignas(64)
+    struct BlockCache {
+	const ClassFile *file = nullptr;
+	uint64_t block = 0;
+	std::vector<uint8_t> buf;
+	char pad[64 - sizeof(const ClassFile *) - sizeof(uint64_t) - sizeof(std::vector<uint8_t>)];
+    };
+
+    int max_pawns = 0;
+    std::array<std::array<ClassFile, N+1>, N+1> files;
+    std::unique_ptr<std::array<BlockCache, MAX_THREAD_SLOTS>> caches;
+
+    TpResult probe_compressed(const ClassFile &f, uint64_t idx) const;
+public:
+    Tablebases();
+    ~Tablebases();
+
+    // Maps all classes with num_white + num_black <= max_pawns from
+    // dir. Aborts if a file is missing or does not match.
+    void load(const std::string &dir, int max_pawns);
+
+    int get_max_pawns() const { return max_pawns; }
+
+    // p must be canonical. Returns NONE if the position has more than
+    // max_pawns pawns.
+    TpResult probe(const Pos &p) const {
+	const int nw = p.get_num_white(), nb = p.get_num_black();
+	if (nw + nb > max_pawns)
+	    return TpResult::NONE;
+	if (nw == 0)
+	    return TpResult::CURRENT_LOSS;
+	if (nb == 0)
+	    return TpResult::CURRENT_WIN;
+	const ClassFile &f = files[nw][nb];
+	const uint64_t idx = tight_index.index(p);
+	if (f.block_offsets)
+	    return probe_compressed(f, idx);
+	return get_packed_result(f.data, idx);
+    }
+};
+
+#endif
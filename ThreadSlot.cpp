@@ -0,0 +1,64 @@
+// Copyright (C) 2016  Sami Liedes
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#include "ThreadSlot.hpp"
+#include <atomic>
+#include <bitset>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+
+thread_local int current_thread_slot = -1;
+
+static std::mutex slot_mutex;
+static std::bitset<MAX_THREAD_SLOTS> slot_in_use;
+static std::atomic<int> slots_used{0};
+
+// Returns the slot to the pool when the owning thread exits.
+class SlotLease {
+public:
+    bool held = false;
+    ~SlotLease() {
+	if (!held)
+	    return;
+	std::lock_guard<std::mutex> guard(slot_mutex);
+	slot_in_use.reset(current_thread_slot);
+	current_thread_slot = -1;
+    }
+};
+
+static thread_local SlotLease slot_lease;
+
+int acquire_thread_slot() {
+    std::lock_guard<std::mutex> guard(slot_mutex);
+    for (int i=0; i<MAX_THREAD_SLOTS; i++)
+	if (!slot_in_use[i]) {
+	    slot_in_use.set(i);
+	    current_thread_slot = i;
+	    slot_lease.held = true;
+	    if (i >= slots_used.load(std::memory_order_relaxed))
+		slots_used.store(i+1, std::memory_order_relaxed);
+	    return i;
+	}
+
+    std::cerr << "Out of thread slots (MAX_THREAD_SLOTS = " << MAX_THREAD_SLOTS
+	      << ")" << std::endl;
+    abort();
+}
+
+int thread_slots_used() {
+    return slots_used.load(std::memory_order_relaxed);
+}
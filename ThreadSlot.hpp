@@ -0,0 +1,42 @@
+// Copyright (C) 2016  Sami Liedes
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#ifndef ThreadSlot_hpp
+#define ThreadSlot_hpp
+
+// Search threads are short-lived (one per parallelized move), so
+// per-thread state is kept in per-slot arrays instead. Each thread
+// leases a small slot number on first use and returns it when it
+// exits; at most MAX_THREAD_SLOTS threads may hold a slot at once.
+
+#define MAX_THREAD_SLOTS 64
+
+extern thread_local int current_thread_slot;
+
+int acquire_thread_slot();
+
+// returns a number in [0, MAX_THREAD_SLOTS) unique among live threads
+static inline int thread_slot() {
+    int slot = current_thread_slot;
+    if (slot < 0)
+	slot = acquire_thread_slot();
+    return slot;
+}
+
+// number of slots that have ever been leased; slots above this are unused
+int thread_slots_used();
+
+#endif
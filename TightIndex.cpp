@@ -0,0 +1,316 @@
+// Copyright (C) 2016  Sami Liedes
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#include "TightIndex.hpp"
+#include "binom.hpp"
+#include <cmath>
+#include <utility>
+
+using std::array;
+using std::make_pair;
+using std::swap;
+
+TightIndex tight_index;
+
+static constexpr uint64_t ALL_SQUARES = (1ULL << NUM_ISQ) - 1;
+
+static inline int popcount(uint64_t m) { return __builtin_popcountll(m); }
+
+// number of ways to place w white and b black pawns on n squares
+static uint64_t placements(int n, int w, int b) {
+    if (w + b > n)
+	return 0;
+    return binom(n, w) * binom(n-w, b);
+}
+
+// number of unordered pairs, repetition allowed, of n things
+static inline uint64_t pairs(uint64_t n) { return n*(n+1)/2; }
+
+// largest h with pairs(h) <= i
+static uint64_t pairs_floor(uint64_t i) {
+    uint64_t h = (sqrt(8.0*i + 1) - 1) / 2;
+    while (pairs(h) > i)
+	h--;
+    while (pairs(h+1) <= i)
+	h++;
+    return h;
+}
+
+// rank of the squares of mask, numbered by their position in allowed
+static uint64_t rank_subset(uint64_t mask, uint64_t allowed) {
+    array<int, NUM_ISQ> cs;
+    int k = 0;
+    for (; mask; mask &= mask-1)
+	cs[k++] = popcount(allowed & ((mask & -mask) - 1));
+    return rank_combination(cs.data(), k);
+}
+
+static uint64_t unrank_subset(int k, uint64_t rank, uint64_t allowed) {
+    array<int, NUM_ISQ> cs;
+    unrank_combination(cs.data(), k, rank);
+    uint64_t mask = 0;
+    for (int i=0; i<k; i++) {
+	uint64_t a = allowed;
+	for (int j=0; j<cs[i]; j++)
+	    a &= a-1;
+	mask |= a & -a;
+    }
+    return mask;
+}
+
+// whites ranked among n squares, blacks among those left free
+static uint64_t rank_part(uint64_t w, uint64_t b, int n) {
+    const uint64_t allowed = (1ULL << n) - 1;
+    return rank_subset(w, allowed) * binom(n - popcount(w), popcount(b)) +
+	rank_subset(b, allowed & ~w);
+}
+
+static void unrank_part(uint64_t rank, int nw, int nb, int n, uint64_t &w, uint64_t &b) {
+    const uint64_t allowed = (1ULL << n) - 1;
+    const uint64_t nblack = binom(n - nw, nb);
+    w = unrank_subset(nw, rank / nblack, allowed);
+    b = unrank_subset(nb, rank % nblack, allowed & ~w);
+}
+
+// Squares of an en passant block: the black pawn that moved, the
+// capturing white pawn, the squares fixed by them (with the two the
+// black pawn passed) and those where other white pawns cannot be.
+struct EpSquares {
+    int black, white;
+    uint64_t fixed, no_white;
+
+    EpSquares(int file, bool right) {
+	black = SQ(file, EP_RANK_BLACK);
+	white = right ? black+1 : black-1;
+	fixed = 1ULL << black | 1ULL << (black+N) | 1ULL << (black+2*N) | 1ULL << white;
+	no_white = fixed;
+	if (right && file > 0)
+	    no_white |= 1ULL << (black-1);
+    }
+
+    // blacks other than the fixed one for each placement of the whites
+    uint64_t num_blacks(int nw, int nb) const {
+	return binom(NUM_ISQ - 4 - (nw-1), nb-1);
+    }
+};
+
+template<class F>
+void TightIndex::for_blocks(int nw, int nb, F f) const {
+    for (int wm=0; wm<=std::min(nw, MID_DIM-1); wm++)
+	for (int bm=0; bm<=std::min(nb, MID_DIM-1); bm++) {
+	    const uint64_t mid = placements(MID_SQ, wm, bm);
+	    for (int wl=0; wl<=nw-wm; wl++)
+		for (int bl=0; bl<=nb-bm; bl++) {
+		    const int wr = nw-wm-wl, br = nb-bm-bl;
+		    if (make_pair(wl, bl) > make_pair(wr, br))
+			continue;
+		    const uint64_t left = placements(HALF_SQ, wl, bl),
+			right = placements(HALF_SQ, wr, br);
+		    const uint64_t size = mid * (wl == wr && bl == br ? pairs(left) : left*right);
+		    if (size > 0)
+			f(wm, bm, wl, bl, size);
+		}
+	}
+}
+
+template<class F>
+void TightIndex::for_ep_blocks(int nw, int nb, F f) const {
+    if (N < 5 || nw == 0 || nb == 0)
+	return;
+    for (int file=0; file<EP_FILES; file++)
+	for (int right=0; right<2; right++) {
+	    if ((!right && file == 0) || (right && file == N-1))
+		continue;
+	    const EpSquares s(file, right);
+	    const uint64_t size = binom(NUM_ISQ - popcount(s.no_white), nw-1) * s.num_blacks(nw, nb);
+	    if (size > 0)
+		f(file, right, size);
+	}
+}
+
+TightIndex::TightIndex() {
+    init_binom();
+
+    for (int s=0; s<NUM_ISQ; s++) {
+	const int rank = s/N, file = s%N;
+	if (file < HALF_FILES) {
+	    part_of[s] = 0;
+	    local_of[s] = rank*HALF_FILES + file;
+	} else if (file >= N-HALF_FILES) {
+	    part_of[s] = 2;
+	    local_of[s] = rank*HALF_FILES + N-1-file;
+	} else {
+	    part_of[s] = 1;
+	    local_of[s] = rank;
+	}
+	square_of[part_of[s]][local_of[s]] = s;
+    }
+
+    block_offsets.resize(block_key(N, N, MID_DIM-1, MID_DIM-1, N, N) + 1);
+    ep_offsets.resize(ep_key(N, N, EP_FILES-1, true) + 1);
+    bases[0] = 0;
+    for (int nw=0; nw<=N; nw++)
+	for (int nb=0; nb<=N; nb++) {
+	    uint64_t size = 0;
+	    if (nw > 0 || nb > 0) {
+		for_blocks(nw, nb, [&](int wm, int bm, int wl, int bl, uint64_t n) {
+			block_offsets[block_key(nw, nb, wm, bm, wl, bl)] = size;
+			size += n;
+		    });
+		no_ep_sizes[nw][nb] = size;
+		size = 0;
+		for_ep_blocks(nw, nb, [&](int file, bool right, uint64_t n) {
+			ep_offsets[ep_key(nw, nb, file, right)] = size;
+			size += n;
+		    });
+		size += no_ep_sizes[nw][nb];
+	    }
+	    sizes[nw][nb] = size;
+	    bases[nw*(N+1)+nb+1] = bases[nw*(N+1)+nb] + size;
+	}
+}
+
+uint64_t TightIndex::index(const Pos &p) const {
+    assert(p.turn == 1);
+    const int nw = p.get_num_white(), nb = p.get_num_black();
+    if (p.ep_file != -1)
+	return no_ep_sizes[nw][nb] + ep_index(p);
+
+    array<uint64_t, 3> w{{0}}, b{{0}};
+    for (int s=0; s<NUM_ISQ; s++)
+	if (p.sq[s] == 1)
+	    w[part_of[s]] |= 1ULL << local_of[s];
+	else if (p.sq[s] == -1)
+	    b[part_of[s]] |= 1ULL << local_of[s];
+
+    int wl = popcount(w[0]), bl = popcount(b[0]), wr = popcount(w[2]), br = popcount(b[2]);
+    if (make_pair(wl, bl) > make_pair(wr, br)) {
+	swap(w[0], w[2]);
+	swap(b[0], b[2]);
+	swap(wl, wr);
+	swap(bl, br);
+    }
+    const uint64_t off = block_offsets[block_key(nw, nb, popcount(w[1]), popcount(b[1]), wl, bl)];
+    const uint64_t mid = rank_part(w[1], b[1], MID_SQ);
+    uint64_t left = rank_part(w[0], b[0], HALF_SQ), right = rank_part(w[2], b[2], HALF_SQ);
+    const uint64_t left_size = placements(HALF_SQ, wl, bl);
+    if (wl != wr || bl != br)
+	return off + (mid*left_size + left)*placements(HALF_SQ, wr, br) + right;
+    if (left > right)
+	swap(left, right);
+    return off + mid*pairs(left_size) + pairs(right) + left;
+}
+
+uint64_t TightIndex::ep_index(const Pos &p) const {
+    Pos q(p);
+    if (N%2 == 1 && q.ep_file == N/2)
+	q.canonize();
+    else if (q.ep_file >= EP_FILES)
+	q.horiz_mirror_board();
+
+    const int file = q.ep_file;
+    const bool right = file == 0 || q.sq[SQ(file-1, EP_RANK_BLACK)] != 1;
+    const EpSquares s(file, right);
+    uint64_t w = 0, b = 0;
+    for (int i=0; i<NUM_ISQ; i++)
+	if (q.sq[i] == 1 && i != s.white)
+	    w |= 1ULL << i;
+	else if (q.sq[i] == -1 && i != s.black)
+	    b |= 1ULL << i;
+    const int nw = q.get_num_white(), nb = q.get_num_black();
+    return ep_offsets[ep_key(nw, nb, file, right)] +
+	rank_subset(w, ALL_SQUARES & ~s.no_white) * s.num_blacks(nw, nb) +
+	rank_subset(b, ALL_SQUARES & ~s.fixed & ~w);
+}
+
+Pos TightIndex::position(int nw, int nb, uint64_t idx) const {
+    assert(idx < size(nw, nb));
+    Pos p;
+    p.clear();
+    p.turn = 1;
+    p.canonized_player_flip = 1;
+    p.horiz_flipped = false;
+    p.ep_file = -1;
+    p.num_white = nw;
+    p.num_black = nb;
+    if (idx >= no_ep_sizes[nw][nb]) {
+	ep_position(nw, nb, idx - no_ep_sizes[nw][nb], p);
+	return p;
+    }
+
+    int wm = 0, bm = 0, wl = 0, bl = 0;
+    for_blocks(nw, nb, [&](int wm_, int bm_, int wl_, int bl_, uint64_t) {
+	    if (block_offsets[block_key(nw, nb, wm_, bm_, wl_, bl_)] <= idx) {
+		wm = wm_;
+		bm = bm_;
+		wl = wl_;
+		bl = bl_;
+	    }
+	});
+    const int wr = nw-wm-wl, br = nb-bm-bl;
+    uint64_t rest = idx - block_offsets[block_key(nw, nb, wm, bm, wl, bl)];
+    const uint64_t left_size = placements(HALF_SQ, wl, bl);
+    uint64_t mid, left, right;
+    if (wl != wr || bl != br) {
+	const uint64_t right_size = placements(HALF_SQ, wr, br);
+	right = rest % right_size;
+	rest /= right_size;
+	left = rest % left_size;
+	mid = rest / left_size;
+    } else {
+	mid = rest / pairs(left_size);
+	rest %= pairs(left_size);
+	right = pairs_floor(rest);
+	left = rest - pairs(right);
+    }
+
+    auto place = [&](int part, uint64_t rank, int w, int b) {
+	uint64_t wmask, bmask;
+	unrank_part(rank, w, b, part == 1 ? MID_SQ : HALF_SQ, wmask, bmask);
+	for (; wmask; wmask &= wmask-1)
+	    p.sq[square_of[part][__builtin_ctzll(wmask)]] = 1;
+	for (; bmask; bmask &= bmask-1)
+	    p.sq[square_of[part][__builtin_ctzll(bmask)]] = -1;
+    };
+    place(0, left, wl, bl);
+    place(1, mid, wm, bm);
+    place(2, right, wr, br);
+    return p;
+}
+
+void TightIndex::ep_position(int nw, int nb, uint64_t idx, Pos &p) const {
+    int file = 0;
+    bool right = false;
+    for_ep_blocks(nw, nb, [&](int file_, bool right_, uint64_t) {
+	    if (ep_offsets[ep_key(nw, nb, file_, right_)] <= idx) {
+		file = file_;
+		right = right_;
+	    }
+	});
+    const EpSquares s(file, right);
+    const uint64_t rest = idx - ep_offsets[ep_key(nw, nb, file, right)];
+    const uint64_t num_blacks = s.num_blacks(nw, nb);
+    const uint64_t w = unrank_subset(nw-1, rest / num_blacks, ALL_SQUARES & ~s.no_white);
+    const uint64_t b = unrank_subset(nb-1, rest % num_blacks, ALL_SQUARES & ~s.fixed & ~w);
+    for (int i=0; i<NUM_ISQ; i++)
+	if (w >> i & 1)
+	    p.sq[i] = 1;
+	else if (b >> i & 1)
+	    p.sq[i] = -1;
+    p.sq[s.white] = 1;
+    p.sq[s.black] = -1;
+    p.ep_file = file;
+}
@@ -0,0 +1,94 @@
+// Copyright (C) 2016  Sami Liedes
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#ifndef TightIndex_hpp
+#define TightIndex_hpp
+
+#include "Pos.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <vector>
+
+// A dense index of the positions of a material class with white to
+// move, much smaller than that of Pos::pack() (see count.py): black
+// pawns are ranked among the squares left free by the white ones, a
+// position and its mirror image share an index, and en passant is only
+// indexed where it is possible.
+//
+// Positions without en passant are split into the left half of the
+// board, the middle file (odd N only) and the right half, with the
+// halves numbered from the edge so that mirroring swaps them. Of the
+// two orientations the one with less material (then the smaller index)
+// on the left is indexed. Positions with en passant come after those;
+// the black pawn that just moved, the two squares it passed and the
+// white pawn next to it that can capture it are implied by the file,
+// which is mirrored to the left half. For odd N, en passant on the
+// middle file leaves some indices unused.
+class TightIndex {
+    static constexpr int HALF_FILES = N/2;
+    static constexpr int HALF_SQ = HALF_FILES*NUM_RANKS;
+    static constexpr int MID_SQ = N%2 ? NUM_RANKS : 0;
+    static constexpr int MID_DIM = N%2 ? N+1 : 1;
+    static constexpr int EP_FILES = (N+1)/2;
+
+    std::array<int, NUM_ISQ> part_of, local_of;
+    std::array<std::array<int, HALF_SQ>, 3> square_of;
+    std::array<std::array<uint64_t, N+1>, N+1> no_ep_sizes, sizes;
+    std::array<uint64_t, (N+1)*(N+1)+1> bases;
+    std::vector<uint64_t> block_offsets; // see block_key()
+    std::vector<uint64_t> ep_offsets; // see ep_key()
+
+    static size_t block_key(int nw, int nb, int wm, int bm, int wl, int bl) {
+	return ((((size_t(nw)*(N+1) + nb)*MID_DIM + wm)*MID_DIM + bm)*(N+1) + wl)*(N+1) + bl;
+    }
+    static size_t ep_key(int nw, int nb, int file, bool right) {
+	return ((size_t(nw)*(N+1) + nb)*EP_FILES + file)*2 + right;
+    }
+
+    // calls f(wm, bm, wl, bl, size) on the blocks of a class in order
+    template<class F> void for_blocks(int nw, int nb, F f) const;
+    // calls f(file, right, size) on the en passant blocks of a class in order
+    template<class F> void for_ep_blocks(int nw, int nb, F f) const;
+
+    uint64_t ep_index(const Pos &p) const;
+    void ep_position(int nw, int nb, uint64_t idx, Pos &p) const;
+public:
+    TightIndex();
+
+    uint64_t size(int nw, int nb) const { return sizes[nw][nb]; }
+
+    // Classes are laid out after each other as in Compact_tab, so
+    // base(nw, nb) + index(p) identifies any position.
+    uint64_t base(int nw, int nb) const { return bases[nw*(N+1)+nb]; }
+
+    // Finds the class of base(nw, nb) + index(p) as Compact_tab::find().
+    int find(uint64_t key) const {
+	return std::upper_bound(&bases[0], &bases[(N+1)*(N+1)], key) - bases.begin() - 1;
+    }
+
+    // p must be valid and have white to move.
+    uint64_t index(const Pos &p) const;
+
+    // A position with the index, in either orientation (so not
+    // necessarily canonical), or with a different index if idx is unused.
+    Pos position(int nw, int nb, uint64_t idx) const;
+};
+
+extern TightIndex tight_index;
+
+#endif
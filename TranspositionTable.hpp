@@ -17,6 +17,10 @@
 #ifndef TranspositionTable_hpp
 #define TranspositionTable_hpp
 
+#include "ThreadSlot.hpp"
+
+#include <array>
+#include <atomic>
 #include <cassert>
 #include <cstdio>
 #include <cstdint>
@@ -36,6 +40,8 @@ enum class TpResult {
     UPPER_BOUND_0 = 5
 };
 
+static constexpr int NUM_TP_RESULTS = 6;
+
 static inline TpResult flip_result(TpResult a) {
     static const TpResult flipped[] = {
 	TpResult::NONE, TpResult::CURRENT_WIN, TpResult::DRAW,
@@ -85,77 +91,180 @@ static inline TpResult merge_results(TpResult a, TpResult b) {
 }
 
 
+// Force inlining of the per-node table operations into the search.
+#define TP_INLINE inline __attribute__ ((always_inline))
+
+// Exact table statistics, summed over all thread slots.
+struct TpTableStats {
+    int64_t occupied = 0;
+    std::array<int64_t, NUM_TP_RESULTS> by_result{{0}}; // occupied slots per TpResult
+    int64_t probes = 0;
+    int64_t hits = 0;
+    int64_t collisions = 0; // probe found another position in the slot
+    int64_t stores = 0;
+    int64_t overwrites = 0; // store replaced another position
+    int64_t merges = 0; // store combined a bound with the old result
+
+    TpTableStats &operator+=(const TpTableStats &a) {
+	occupied += a.occupied;
+	for (int i=0; i<NUM_TP_RESULTS; i++)
+	    by_result[i] += a.by_result[i];
+	probes += a.probes;
+	hits += a.hits;
+	collisions += a.collisions;
+	stores += a.stores;
+	overwrites += a.overwrites;
+	merges += a.merges;
+	return *this;
+    }
+};
+
 // Contains everything that does not depend on capacity
 class TranspositionTableBase {
-protected:
+public:
+    // positions must be below capacity << POS_BITS
     static constexpr int POS_BITS = 29;
+protected:
     typedef uint32_t saved_pos_t;
     struct Entry { // used by many subclasses, but optional
 	saved_pos_t pos : POS_BITS;
 	unsigned result : 3; // actually a TpResult
     } __attribute__ ((packed));
 
-    virtual saved_pos_t pos_to_saved(uint64_t pos) const = 0;
-    virtual uint64_t saved_to_pos(saved_pos_t saved, size_t hash_slot) const = 0;
+    // Counters are sharded by thread slot and only written by the slot
+    // owner, so a relaxed load+store suffices. Occupancy counts may go
+    // negative in a single shard; only the sum is meaningful. Stores are
+    // counted from the entry read before them, so two threads racing on
+    // the same slot may both count the old entry and the occupancy
+    // drifts slightly.
+    struct alignas(64) StatsShard {
+	std::atomic<int64_t> occupied{0};
+	std::array<std::atomic<int64_t>, NUM_TP_RESULTS> by_result;
+	std::atomic<int64_t> probes{0}, hits{0}, collisions{0};
+	std::atomic<int64_t> stores{0}, overwrites{0}, merges{0};
+	StatsShard() { for (auto &c : by_result) c.store(0, std::memory_order_relaxed); }
+    };
+    std::array<StatsShard, MAX_THREAD_SLOTS> shards;
+
+    static void bump(std::atomic<int64_t> &c, int64_t delta = 1) {
+	c.store(c.load(std::memory_order_relaxed)+delta, std::memory_order_relaxed);
+    }
+    StatsShard &shard() { return shards[thread_slot()]; }
+
+    void count_probe(const Entry &e, saved_pos_t saved_pos) {
+	StatsShard &s = shard();
+	bump(s.probes);
+	if (TpResult(e.result) == TpResult::NONE)
+	    return;
+	if (e.pos == saved_pos)
+	    bump(s.hits);
+	else
+	    bump(s.collisions);
+    }
+
+    // old = entry replaced by new_e
+    void count_store(const Entry &old, const Entry &new_e) {
+	StatsShard &s = shard();
+	bump(s.stores);
+	if (TpResult(old.result) == TpResult::NONE)
+	    bump(s.occupied);
+	else {
+	    bump(s.by_result[old.result], -1);
+	    if (old.pos != new_e.pos)
+		bump(s.overwrites);
+	}
+	bump(s.by_result[new_e.result]);
+    }
+
+    // reset the occupancy counts to those of a table with given contents
+    void reset_occupancy(const std::array<int64_t, NUM_TP_RESULTS> &by_result) {
+	for (StatsShard &s : shards) {
+	    s.occupied.store(0, std::memory_order_relaxed);
+	    for (auto &c : s.by_result)
+		c.store(0, std::memory_order_relaxed);
+	}
+	for (int i=1; i<NUM_TP_RESULTS; i++) {
+	    shards[0].by_result[i].store(by_result[i], std::memory_order_relaxed);
+	    bump(shards[0].occupied, by_result[i]);
+	}
+    }
 public:
-    virtual void add(uint64_t pos, TpResult result) = 0;
-    virtual TpResult probe(uint64_t pos) = 0;
-    virtual size_t size() const = 0; // estimate
-    virtual size_t get_capacity() const = 0;
-    virtual bool is_empty_slot(uint64_t pos) const = 0;
-    virtual void save(const char *fname) const = 0;
-    virtual void load(const char *fname) = 0;
+    TpTableStats stats() const {
+	TpTableStats st;
+	for (const StatsShard &s : shards) {
+	    st.occupied += s.occupied.load(std::memory_order_relaxed);
+	    for (int i=0; i<NUM_TP_RESULTS; i++)
+		st.by_result[i] += s.by_result[i].load(std::memory_order_relaxed);
+	    st.probes += s.probes.load(std::memory_order_relaxed);
+	    st.hits += s.hits.load(std::memory_order_relaxed);
+	    st.collisions += s.collisions.load(std::memory_order_relaxed);
+	    st.stores += s.stores.load(std::memory_order_relaxed);
+	    st.overwrites += s.overwrites.load(std::memory_order_relaxed);
+	    st.merges += s.merges.load(std::memory_order_relaxed);
+	}
+	return st;
+    }
+
+    // number of occupied slots (approximate under concurrent stores)
+    size_t size() const { return stats().occupied; }
 };
 
-template<size_t CAPACITY>
+// Tables are composed at compile time and called directly by the
+// search, so there is no virtual dispatch per node.
+// Derived must provide read_entry(size_t) and write_entry(size_t, const Entry &).
+template<class Derived, size_t CAPACITY>
 class TranspositionTable : public TranspositionTableBase {
+    Derived &self() { return static_cast<Derived &>(*this); }
+    const Derived &self() const { return static_cast<const Derived &>(*this); }
 protected:
     //size_t hash(uint64_t pos) const { return pos*21538613260663%CAPACITY; }
     size_t hash(uint64_t pos) const { return pos%CAPACITY; }
-    virtual void write_entry(size_t n, const TranspositionTableBase::Entry &entry) = 0;
-    virtual TranspositionTableBase::Entry read_entry(size_t n) const = 0;
-    saved_pos_t pos_to_saved(uint64_t pos) const override;
-    uint64_t saved_to_pos(saved_pos_t saved, size_t hash_slot) const override;
+    saved_pos_t pos_to_saved(uint64_t pos) const;
+    uint64_t saved_to_pos(saved_pos_t saved, size_t hash_slot) const;
 public:
     static constexpr size_t capacity = CAPACITY;
-    size_t get_capacity() const override { return capacity; }
-    bool is_empty_slot(uint64_t pos) const override;
-    void add(uint64_t pos, TpResult result) override;
-    TpResult probe(uint64_t pos) override;
-    void save(const char *fname) const override;
-    void load(const char *fname) override;
+    size_t get_capacity() const { return capacity; }
+    bool is_empty_slot(uint64_t pos) const;
+    void add(uint64_t pos, TpResult result);
+    // same interface as CachedTranspositionTable; everything is stored
+    void add(uint64_t pos, TpResult result, uint64_t /*subtree_nodes*/) { add(pos, result); }
+    TpResult probe(uint64_t pos);
+    void save(const char *fname) const;
+    void load(const char *fname);
 };
 
-template<size_t CAPACITY>
-TranspositionTableBase::saved_pos_t TranspositionTable<CAPACITY>::pos_to_saved(uint64_t pos) const {
+template<class Derived, size_t CAPACITY>
+TP_INLINE TranspositionTableBase::saved_pos_t
+TranspositionTable<Derived, CAPACITY>::pos_to_saved(uint64_t pos) const {
     uint64_t a = pos/CAPACITY;
     assert(a < (1 << POS_BITS));
     return saved_pos_t(a);
 }
 
-template<size_t CAPACITY>
-uint64_t TranspositionTable<CAPACITY>::saved_to_pos(saved_pos_t a, size_t hash_slot) const {
+template<class Derived, size_t CAPACITY>
+uint64_t TranspositionTable<Derived, CAPACITY>::saved_to_pos(saved_pos_t a, size_t hash_slot) const {
     return a*CAPACITY + hash_slot;
 }
 
-template<size_t CAPACITY>
-bool TranspositionTable<CAPACITY>::is_empty_slot(uint64_t pos) const {
-    Entry e = read_entry(hash(pos));
+template<class Derived, size_t CAPACITY>
+bool TranspositionTable<Derived, CAPACITY>::is_empty_slot(uint64_t pos) const {
+    Entry e = self().read_entry(hash(pos));
     return TpResult(e.result) == TpResult::NONE;
 }
 
-template<size_t CAPACITY>
-inline TpResult TranspositionTable<CAPACITY>::probe(uint64_t pos) {
-    Entry e = read_entry(hash(pos));
+template<class Derived, size_t CAPACITY>
+TP_INLINE TpResult TranspositionTable<Derived, CAPACITY>::probe(uint64_t pos) {
+    Entry e = self().read_entry(hash(pos));
     TpResult res = TpResult(e.result);
     saved_pos_t saved_pos = pos_to_saved(pos);
+    count_probe(e, saved_pos);
     if (e.pos != saved_pos)
 	return TpResult::NONE;
     return res;
 }
 
-template<size_t CAPACITY>
-inline void TranspositionTable<CAPACITY>::add(uint64_t pos, TpResult result) {
+template<class Derived, size_t CAPACITY>
+TP_INLINE void TranspositionTable<Derived, CAPACITY>::add(uint64_t pos, TpResult result) {
     if (DEBUG_POSITION != 0 && pos == DEBUG_POSITION) {
 	std::cout << "Add position " << pos << " with result " << static_cast<int>(result)
 		  << std::endl;
@@ -170,17 +279,20 @@ inline void TranspositionTable<CAPACITY>::add(uint64_t pos, TpResult result) {
 
     const size_t ha = hash(pos);
 
-    if (result == TpResult::LOWER_BOUND_0 || result == TpResult::UPPER_BOUND_0 || DEBUG_TP) {
-	Entry old = read_entry(ha);
-	if (old.pos == e.pos)
-	    e.result = static_cast<int>(merge_results(result, TpResult(old.result)));
+    const Entry old = self().read_entry(ha);
+    if ((result == TpResult::LOWER_BOUND_0 || result == TpResult::UPPER_BOUND_0 || DEBUG_TP)
+	&& old.pos == e.pos) {
+	e.result = static_cast<int>(merge_results(result, TpResult(old.result)));
+	if (TpResult(e.result) != result)
+	    bump(shard().merges);
     }
 
-    write_entry(ha, e);
+    self().write_entry(ha, e);
+    count_store(old, e);
 }
 
-template<size_t CAPACITY>
-void TranspositionTable<CAPACITY>::save(const char *fname) const {
+template<class Derived, size_t CAPACITY>
+void TranspositionTable<Derived, CAPACITY>::save(const char *fname) const {
     FILE *fp = fopen(fname, "wb");
     assert(fp && "Could not open save file for write");
 
@@ -196,7 +308,7 @@ void TranspositionTable<CAPACITY>::save(const char *fname) const {
 
     // FIXME slow
     for (size_t i = 0; i < CAPACITY; i++) {
-	Entry e = read_entry(i);
+	Entry e = self().read_entry(i);
 	size_t res = fwrite(&e, sizeof(e), 1, fp);
 	if (res != 1) {
 	    std::cerr << "Short write" << std::endl;
@@ -211,8 +323,8 @@ void TranspositionTable<CAPACITY>::save(const char *fname) const {
     }
 }
 
-template<size_t CAPACITY>
-void TranspositionTable<CAPACITY>::load(const char *fname) {
+template<class Derived, size_t CAPACITY>
+void TranspositionTable<Derived, CAPACITY>::load(const char *fname) {
     FILE *fp = fopen(fname, "rb");
     assert(fp && "Could not open save file for read.");
 
@@ -231,6 +343,7 @@ void TranspositionTable<CAPACITY>::load(const char *fname) {
     }
 
     // FIXME slow
+    std::array<int64_t, NUM_TP_RESULTS> by_result{{0}};
     for (size_t i = 0; i < CAPACITY; i++) {
 	Entry e;
 	size_t res = fread(&e, sizeof(e), 1, fp);
@@ -238,8 +351,10 @@ void TranspositionTable<CAPACITY>::load(const char *fname) {
 	    std::cerr << "Short read" << std::endl;
 	    abort();
 	}
-	write_entry(i, e);
+	self().write_entry(i, e);
+	by_result[e.result]++;
     }
+    reset_occupancy(by_result);
 
     size_t res = fclose(fp);
     if (res != 0) {
@@ -0,0 +1,131 @@
+// Copyright (C) 2016  Sami Liedes
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+#ifndef TreeStats_hpp
+#define TreeStats_hpp
+
+#include "Pos.hpp"
+#include "ThreadSlot.hpp"
+#include "TranspositionTable.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <ostream>
+
+// Per-depth histograms of the search tree: nodes, legal moves before
+// and after symmetry pruning, the index of the move that caused each
+// cutoff, table probes by the TpResult found and terminal results.
+// Sharded by thread slot like SearchCounters. pawnsonly only collects
+// them when built with -DTREE_STATS.
+class TreeStats {
+public:
+    // every move increases Pos::get_progress()
+    static constexpr int MAX_DEPTH = MAX_PROGRESS + 1;
+
+    enum Counter {
+	NODES,
+	MOVES,
+	MOVES_AFTER_SYMMETRY,
+	TB_HITS,
+	CUTOFF_AT, // + index of the move
+	TP_RESULT = CUTOFF_AT + MAX_LEGAL_MOVES, // + TpResult; NONE = miss
+	TERMINAL = TP_RESULT + NUM_TP_RESULTS, // + 1 + result for the side to move
+	NUM_COUNTERS = TERMINAL + 3
+    };
+
+    typedef std::array<std::array<uint64_t, NUM_COUNTERS>, MAX_DEPTH+1> Totals;
+
+    struct alignas(64) Slot {
+	std::array<std::array<std::atomic<uint64_t>, NUM_COUNTERS>, MAX_DEPTH+1> depths;
+
+	Slot() {
+	    for (auto &d : depths)
+		for (auto &c : d)
+		    c.store(0, std::memory_order_relaxed);
+	}
+
+	// only the owner of the slot writes
+	void bump(int depth, int counter, uint64_t delta = 1) {
+	    std::atomic<uint64_t> &c = depths[std::min(depth, MAX_DEPTH)][counter];
+	    c.store(c.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+	}
+    };
+private:
+    std::array<Slot, MAX_THREAD_SLOTS> slots;
+public:
+    Slot &local() { return slots[thread_slot()]; }
+
+    Totals totals() const {
+	Totals t{};
+	for (int s=0; s<thread_slots_used(); s++)
+	    for (int d=0; d<=MAX_DEPTH; d++)
+		for (int i=0; i<NUM_COUNTERS; i++)
+		    t[d][i] += slots[s].depths[d][i].load(std::memory_order_relaxed);
+	return t;
+    }
+
+    void report(std::ostream &os) const;
+};
+
+inline void TreeStats::report(std::ostream &os) const {
+    const Totals t = totals();
+    uint64_t total_nodes = 0;
+    for (const auto &d : t)
+	total_nodes += d[NODES];
+    if (total_nodes == 0)
+	return;
+
+    // moves = average legal moves, symm = after symmetry pruning, 1st% =
+    // cutoffs by the first move tried, avgidx = average index of the
+    // cutoff move; the tp columns are the probes of positions at the
+    // depth by what they found
+    char buf[512];
+    snprintf(buf, sizeof(buf), "%5s %12s %6s %6s %6s %10s %6s %6s %10s %10s %10s %10s %10s"
+	     " %10s %10s %10s %10s %10s\n", "depth", "nodes", "%", "moves", "symm", "cutoffs",
+	     "1st%", "avgidx", "tp miss", "tp loss", "tp draw", "tp win", "tp >=0", "tp <=0",
+	     "tb hits", "lost", "drawn", "won");
+    os << buf;
+    for (int depth=0; depth<=MAX_DEPTH; depth++) {
+	const auto &d = t[depth];
+	if (d[NODES] == 0 && d[TP_RESULT] == 0 && d[TB_HITS] == 0)
+	    continue;
+	uint64_t cutoffs = 0;
+	double idx = 0;
+	for (int i=0; i<MAX_LEGAL_MOVES; i++) {
+	    cutoffs += d[CUTOFF_AT+i];
+	    idx += i*double(d[CUTOFF_AT+i]);
+	}
+	const double nodes = std::max<double>(d[NODES], 1);
+	snprintf(buf, sizeof(buf), "%5d %12llu %6.2f %6.2f %6.2f %10llu %6.1f %6.2f", depth,
+		 (unsigned long long)d[NODES], d[NODES]*100.0/total_nodes, d[MOVES]/nodes,
+		 d[MOVES_AFTER_SYMMETRY]/nodes, (unsigned long long)cutoffs,
+		 d[CUTOFF_AT]*100.0/std::max<double>(cutoffs, 1), idx/std::max<double>(cutoffs, 1));
+	os << buf;
+	for (int i=0; i<NUM_TP_RESULTS; i++) {
+	    snprintf(buf, sizeof(buf), " %10llu", (unsigned long long)d[TP_RESULT+i]);
+	    os << buf;
+	}
+	snprintf(buf, sizeof(buf), " %10llu %10llu %10llu %10llu\n", (unsigned long long)d[TB_HITS],
+		 (unsigned long long)d[TERMINAL], (unsigned long long)d[TERMINAL+1],
+		 (unsigned long long)d[TERMINAL+2]);
+	os << buf;
+    }
+}
+
+#endif
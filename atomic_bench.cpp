@@ -1,24 +1,329 @@
+// Copyright (C) 2016  Sami Liedes
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+// Benchmarks ways to store transposition table entries that many
+// threads read and write at random at once. Every entry written holds
+// a key and a check value derived from it, so a reader can tell when
+// it got parts of two different writes (a torn read). Schemes that
+// detect tearing themselves reject such reads (or retry them) instead.
+//
+// Build with -mcx16 for an inline cmpxchg16b.
+
+#include <algorithm>
 #include <array>
 #include <atomic>
+#include <chrono>
 #include <cstdint>
+#include <cstdio>
+#include <cstdlib>
 #include <iostream>
+#include <memory>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+using std::atomic;
+using std::cerr;
+using std::endl;
+using std::thread;
+using std::vector;
+
+static constexpr size_t DEFAULT_ENTRIES = 1 << 24;
+static constexpr uint64_t DEFAULT_OPS = 1 << 24; // per thread
+static constexpr int READ_PERCENT = 50;
 
-struct Entry {
-    uint32_t pos;
-} __attribute__ ((packed));
+enum class Read { EMPTY, OK, TORN, REJECTED };
 
-constexpr size_t N = 1000000000;
+// splitmix64 finalizer
+static uint64_t mix(uint64_t z) {
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// the value stored with key; stands in for the result
+static uint64_t check_of(uint64_t key) { return mix(key ^ 0x9e3779b97f4a7c15ULL); }
+
+// 29-bit key and 3-bit result as TranspositionTableBase::Entry
+class Atomic32 {
+    std::unique_ptr<atomic<uint32_t>[]> tab;
+public:
+    static constexpr const char *name = "4-byte relaxed";
+    static constexpr int bytes = 4;
+    Atomic32(size_t n) : tab(new atomic<uint32_t>[n]()) {}
+    bool is_lock_free() const { return tab[0].is_lock_free(); }
+    void store(size_t slot, uint64_t key) {
+	key &= (1 << 29) - 1;
+	tab[slot].store(uint32_t(key << 3 | (1 + check_of(key)%7)), std::memory_order_relaxed);
+    }
+    Read load(size_t slot, uint64_t &key) {
+	const uint32_t e = tab[slot].load(std::memory_order_relaxed);
+	if (e == 0)
+	    return Read::EMPTY;
+	key = e >> 3;
+	return (e & 7) == 1 + check_of(key)%7 ? Read::OK : Read::TORN;
+    }
+};
 
-std::array<std::atomic<Entry>, N> *arr;
+// 48-bit key and 16 bits of check
+class Atomic64 {
+    std::unique_ptr<atomic<uint64_t>[]> tab;
+public:
+    static constexpr const char *name = "8-byte relaxed";
+    static constexpr int bytes = 8;
+    Atomic64(size_t n) : tab(new atomic<uint64_t>[n]()) {}
+    bool is_lock_free() const { return tab[0].is_lock_free(); }
+    void store(size_t slot, uint64_t key) {
+	key &= (1ULL << 48) - 1;
+	tab[slot].store(key << 16 | (check_of(key) & 0xffff), std::memory_order_relaxed);
+    }
+    Read load(size_t slot, uint64_t &key) {
+	const uint64_t e = tab[slot].load(std::memory_order_relaxed);
+	if (e == 0)
+	    return Read::EMPTY;
+	key = e >> 16;
+	return (e & 0xffff) == (check_of(key) & 0xffff) ? Read::OK : Read::TORN;
+    }
+};
 
-int main() {
-    arr = new std::array<std::atomic<Entry>, N>();
+// Full key and check in 16 bytes, read and written with cmpxchg16b
+// (a read is a compare-and-swap of zero with zero).
+class Cas128 {
+    typedef unsigned __int128 u128;
+    struct alignas(16) Entry { u128 v; };
+    std::unique_ptr<Entry[]> tab;
+public:
+    static constexpr const char *name = "16-byte cmpxchg16b";
+    static constexpr int bytes = 16;
+    Cas128(size_t n) : tab(new Entry[n]()) {}
+#ifdef __GCC_HAVE_SYNC_COMPARE_AND_SWAP_16
+    bool is_lock_free() const { return true; }
+#else
+    bool is_lock_free() const { return false; }
+#endif
+    void store(size_t slot, uint64_t key) {
+	const u128 e = u128(key) << 64 | check_of(key);
+	u128 old = 0, seen;
+	while ((seen = __sync_val_compare_and_swap(&tab[slot].v, old, e)) != old)
+	    old = seen;
+    }
+    Read load(size_t slot, uint64_t &key) {
+	const u128 e = __sync_val_compare_and_swap(&tab[slot].v, 0, 0);
+	if (e == 0)
+	    return Read::EMPTY;
+	key = uint64_t(e >> 64);
+	return uint64_t(e) == check_of(key) ? Read::OK : Read::TORN;
+    }
+};
 
-    std::cout << "lock_free(): " << (*arr)[100].is_lock_free() << std::endl;
+// Two relaxed 8-byte words, key^data and data, as in the lockless
+// hashing of Hyatt and Mann: a torn pair gives a key that does not
+// match, so it is rejected like any other miss.
+class XorLockless {
+    struct Entry { atomic<uint64_t> key_xor_data{0}, data{0}; };
+    std::unique_ptr<Entry[]> tab;
+public:
+    static constexpr const char *name = "XOR-validated pair";
+    static constexpr int bytes = 16;
+    XorLockless(size_t n) : tab(new Entry[n]()) {}
+    bool is_lock_free() const { return tab[0].data.is_lock_free(); }
+    void store(size_t slot, uint64_t key) {
+	const uint64_t data = check_of(key);
+	tab[slot].key_xor_data.store(key ^ data, std::memory_order_relaxed);
+	tab[slot].data.store(data, std::memory_order_relaxed);
+    }
+    Read load(size_t slot, uint64_t &key) {
+	const uint64_t data = tab[slot].data.load(std::memory_order_relaxed);
+	key = tab[slot].key_xor_data.load(std::memory_order_relaxed) ^ data;
+	if (data == 0)
+	    return Read::EMPTY;
+	// The key is validated against the one being probed, which is
+	// what check_of() stands in for here.
+	return data == check_of(key) ? Read::OK : Read::REJECTED;
+    }
+};
 
-    for (size_t i=0; i<N; i++) {
-	Entry e;
-	e.pos = 1;
-	(*arr)[i].store(e, std::memory_order_relaxed);
+// Buckets of BUCKET_SIZE 16-byte entries with a sequence number that
+// writers make odd while they write; readers retry if it changed. (Not
+// aligned to cache lines, as that needs the aligned new of C++17.)
+class SeqlockBucket {
+    static constexpr int BUCKET_SIZE = 4;
+    struct Entry { atomic<uint64_t> key{0}, data{0}; };
+    struct Bucket {
+	atomic<uint32_t> seq{0};
+	std::array<Entry, BUCKET_SIZE> entries;
+    };
+    std::unique_ptr<Bucket[]> tab;
+public:
+    static constexpr const char *name = "seqlock buckets";
+    static constexpr int bytes = sizeof(Bucket)/BUCKET_SIZE;
+    SeqlockBucket(size_t n) : tab(new Bucket[(n + BUCKET_SIZE-1)/BUCKET_SIZE]()) {}
+    bool is_lock_free() const { return false; }
+    void store(size_t slot, uint64_t key) {
+	Bucket &b = tab[slot/BUCKET_SIZE];
+	uint32_t seq = b.seq.load(std::memory_order_relaxed);
+	while (seq % 2 || !b.seq.compare_exchange_weak(seq, seq+1, std::memory_order_acquire))
+	    seq = b.seq.load(std::memory_order_relaxed);
+	Entry &e = b.entries[slot%BUCKET_SIZE];
+	e.key.store(key, std::memory_order_relaxed);
+	e.data.store(check_of(key), std::memory_order_relaxed);
+	b.seq.store(seq+2, std::memory_order_release);
+    }
+    // returns REJECTED for a read that had to be retried
+    Read load(size_t slot, uint64_t &key) {
+	Bucket &b = tab[slot/BUCKET_SIZE];
+	const Entry &e = b.entries[slot%BUCKET_SIZE];
+	bool retried = false;
+	uint64_t data;
+	while (true) {
+	    const uint32_t seq = b.seq.load(std::memory_order_acquire);
+	    if (seq % 2 == 0) {
+		key = e.key.load(std::memory_order_relaxed);
+		data = e.data.load(std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (b.seq.load(std::memory_order_relaxed) == seq)
+		    break;
+	    }
+	    retried = true;
+	}
+	if (data == 0)
+	    return Read::EMPTY;
+	if (data != check_of(key))
+	    return Read::TORN;
+	return retried ? Read::REJECTED : Read::OK;
     }
+};
+
+// Plain 16-byte stores and loads, racing (volatile so that the
+// compiler does not merge or drop them).
+class Plain {
+    struct Entry { uint64_t key, data; };
+    std::unique_ptr<Entry[]> tab;
+public:
+    static constexpr const char *name = "plain non-atomic";
+    static constexpr int bytes = 16;
+    Plain(size_t n) : tab(new Entry[n]()) {}
+    bool is_lock_free() const { return true; }
+    void store(size_t slot, uint64_t key) {
+	volatile Entry &e = tab[slot];
+	e.key = key;
+	e.data = check_of(key);
+    }
+    Read load(size_t slot, uint64_t &key) {
+	volatile Entry &e = tab[slot];
+	key = e.key;
+	const uint64_t data = e.data;
+	if (data == 0)
+	    return Read::EMPTY;
+	return data == check_of(key) ? Read::OK : Read::TORN;
+    }
+};
+
+struct Counts {
+    uint64_t reads = 0, torn = 0, rejected = 0, sink = 0;
+    char pad[32];
+};
+
+template<class Scheme>
+static void run(int num_threads, size_t num_entries, uint64_t ops) {
+    Scheme table(num_entries);
+    vector<Counts> counts(num_threads);
+    vector<thread> threads;
+    const auto start = std::chrono::steady_clock::now();
+    for (int t=0; t<num_threads; t++) {
+	threads.emplace_back([&table, &counts, t, num_entries, ops] {
+		Counts c;
+		uint64_t rng = mix(t+1);
+		for (uint64_t i=0; i<ops; i++) {
+		    rng = mix(rng);
+		    const size_t slot = (unsigned __int128)rng * num_entries >> 64;
+		    if (rng % 100 < READ_PERCENT) {
+			uint64_t key = 0;
+			c.reads++;
+			switch (table.load(slot, key)) {
+			case Read::TORN:
+			    c.torn++;
+			    break;
+			case Read::REJECTED:
+			    c.rejected++;
+			    break;
+			default:
+			    c.sink += key;
+			}
+		    } else
+			table.store(slot, rng >> 1 | 1);
+		}
+		counts[t] = c;
+	    });
+    }
+    for (auto &t : threads)
+	t.join();
+    const double secs =
+	std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    Counts total;
+    for (const Counts &c : counts) {
+	total.reads += c.reads;
+	total.torn += c.torn;
+	total.rejected += c.rejected;
+    }
+    const double reads = std::max<double>(total.reads, 1);
+    printf("%-20s %6d %10s %10.1f %14.3f %14.3f\n", Scheme::name, Scheme::bytes,
+	   table.is_lock_free() ? "yes" : "no", num_threads*ops/secs*1e-6,
+	   total.torn/reads*1e6, total.rejected/reads*1e6);
+    fflush(stdout);
+}
+
+static void usage(const char *argv0) {
+    cerr << "Usage: " << argv0 << " [-t THREADS] [-e ENTRIES] [-n OPS_PER_THREAD]" << endl;
+}
+
+int main(int argc, char **argv) {
+    int num_threads = std::max(2u, std::thread::hardware_concurrency());
+    size_t num_entries = DEFAULT_ENTRIES;
+    uint64_t ops = DEFAULT_OPS;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:e:n:h")) != -1) {
+	switch (opt) {
+	case 't':
+	    num_threads = atoi(optarg);
+	    break;
+	case 'e':
+	    num_entries = atoll(optarg);
+	    break;
+	case 'n':
+	    ops = atoll(optarg);
+	    break;
+	default:
+	    usage(argv[0]);
+	    return opt == 'h' ? 0 : 1;
+	}
+    }
+    if (num_threads < 1 || num_entries < 1) {
+	usage(argv[0]);
+	return 1;
+    }
+
+    printf("%d threads, %zu entries, %d%% reads\n\n", num_threads, num_entries, READ_PERCENT);
+    printf("%-20s %6s %10s %10s %14s %14s\n", "scheme", "bytes", "lock-free", "Mops/s",
+	   "torn/M reads", "rejected/M");
+    run<Atomic32>(num_threads, num_entries, ops);
+    run<Atomic64>(num_threads, num_entries, ops);
+    run<Cas128>(num_threads, num_entries, ops);
+    run<XorLockless>(num_threads, num_entries, ops);
+    run<SeqlockBucket>(num_threads, num_entries, ops);
+    run<Plain>(num_threads, num_entries, ops);
 }
@@ -0,0 +1,139 @@
+#!/usr/bin/env python3
+#
+# Copyright (C) 2016  Sami Liedes
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+# Solves a fixed set of positions with the bench-build/pawnsonly-N
+# binaries (make bench builds them and runs this) and compares the
+# results against a stored baseline.
+#
+# Node counts vary a little from run to run because of the threads, so
+# they are only flagged when they change by more than NODE_TOLERANCE. A
+# changed result is always an error.
+
+import argparse
+import json
+import os
+import shlex
+import subprocess
+import sys
+import tempfile
+
+# (board size, position or None for the initial one). The benchmark
+# builds use a small transposition table, which on 8x8 can only hold
+# positions with at most 5 pawns of each color.
+CASES = [
+    (4, None),
+    (5, None),
+    (6, None),
+    (7, "7/pppppp1/7/7/PPPPPP1 w -"),
+    (7, "7/p1pppp1/7/7/P1PPPP1 w -"),
+    (7, "7/1p1pp1p/p6/P2P3/1P3PP b -"),
+    (8, "8/ppppp3/8/8/8/PPPPP3 w -"),
+    (8, "8/1ppppp2/8/8/8/1PPPPP2 w -"),
+    (8, "8/p1pp1p1p/8/8/8/P1PP1P1P w -"),
+]
+
+NODE_TOLERANCE = 0.05
+TIME_TOLERANCE = 0.10
+
+def case_name(n, position):
+    return "%dx%d %s" % (n, n, position or "initial")
+
+def run_case(bin_dir, n, position, extra_args=[]):
+    with tempfile.NamedTemporaryFile(suffix=".json") as f:
+        cmd = [os.path.join(bin_dir, "pawnsonly-%d" % n), "--bench-json", f.name]
+        if position:
+            cmd += ["--position", position]
+        cmd += extra_args
+        subprocess.check_call(cmd, stdout=subprocess.DEVNULL)
+        return json.load(open(f.name))
+
+def run_all(args):
+    results = {}
+    for n, position in CASES:
+        name = case_name(n, position)
+        if args.only and args.only not in name:
+            continue
+        runs = sorted((run_case(args.bin_dir, n, position, shlex.split(args.args)) for i in range(args.repeat)),
+                      key=lambda r: r["seconds"])
+        r = runs[len(runs)//2] # median time
+        r["peak_rss_kb"] = max(x["peak_rss_kb"] for x in runs)
+        if len(set(x["result"] for x in runs)) != 1:
+            print("%s: result differs between runs" % name, file=sys.stderr)
+            sys.exit(1)
+        results[name] = r
+        bound = {"upper": "<=", "lower": ">="}.get(r.get("bound"), "=")
+        print("%-36s result%s%2d %8.3f s %11d nodes %10.0f nodes/s %5.1f%% TT hits %7d kB" %
+              (name, bound, r["result"], r["seconds"], r["nodes"], r["nodes_per_sec"],
+               r["tp_hit_rate"]*100, r["peak_rss_kb"]))
+        sys.stdout.flush()
+    return results
+
+def compare(results, baseline):
+    ok = True
+    print()
+    print("Compared to the baseline:")
+    for name, r in results.items():
+        if name not in baseline:
+            print("%-36s not in baseline" % name)
+            continue
+        b = baseline[name]
+        notes = []
+        # --prove=win or --prove=loss may only give a bound on the result
+        bound = r.get("bound", "exact")
+        if (b["result"] < r["result"] if bound == "lower" else
+            b["result"] > r["result"] if bound == "upper" else
+            r["result"] != b["result"]):
+            notes.append("RESULT CHANGED from %d" % b["result"])
+            ok = False
+        nodes = r["nodes"]/b["nodes"] - 1
+        if abs(nodes) > NODE_TOLERANCE:
+            notes.append("nodes %+.1f%%" % (nodes*100))
+        time = r["seconds"]/b["seconds"] - 1
+        if abs(time) > TIME_TOLERANCE:
+            notes.append("time %+.1f%%" % (time*100))
+        print("%-36s %s" % (name, ", ".join(notes) or "unchanged"))
+    return ok
+
+def main():
+    parser = argparse.ArgumentParser(description="Run the pawnsonly benchmark suite.")
+    parser.add_argument("--bin-dir", default="bench-build")
+    parser.add_argument("--baseline", default="bench_baseline.json")
+    parser.add_argument("--output", default="bench_results.json")
+    parser.add_argument("--repeat", type=int, default=3,
+                        help="runs per case; the one with the median time is kept")
+    parser.add_argument("--only", help="only run cases whose name contains this")
+    parser.add_argument("--args", default="",
+                        help="extra arguments for pawnsonly, e.g. --args=--prove=both")
+    parser.add_argument("--save-baseline", action="store_true",
+                        help="store the results as the new baseline")
+    args = parser.parse_args()
+
+    results = run_all(args)
+    with open(args.output, "w") as f:
+        json.dump(results, f, indent=2, sort_keys=True)
+
+    if args.save_baseline:
+        with open(args.baseline, "w") as f:
+            json.dump(results, f, indent=2, sort_keys=True)
+        print("Saved baseline to %s" % args.baseline)
+    elif os.path.exists(args.baseline):
+        if not compare(results, json.load(open(args.baseline))):
+            sys.exit(1)
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,448 @@
+// Copyright (C) 2016  Sami Liedes
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+// Layered solver. Every move increases Pos::get_progress(), so the
+// positions reachable from the initial position fall into layers by
+// progress, and the children of a position are at most
+// MAX_PROGRESS_STEP layers ahead. There is no hashing, so the result
+// is exact.
+//
+// Everything is streamed through disk, so the memory use is set by
+// --memory rather than by the size of the layers:
+//
+// - The forward pass expands layer k by streaming it from its file;
+//   the children go to an ExternalSorter for each of the following
+//   MAX_PROGRESS_STEP layers. When the pass gets to a layer, its sorter
+//   is merged without duplicates into the layer file layer<k>.pos.
+//
+// - The backward pass solves the layers from the last to the first.
+//   Expanding layer k again gives edges (child, parent index), sorted
+//   by child for each child layer and merge-joined with the child
+//   layer's positions and results. This gives the result of every
+//   child by parent index; those are sorted by parent index and
+//   combined into layer<k>.res, 2 bits per position in the order of
+//   layer<k>.pos.
+//
+// Positions found in the tablebases and finished games are leaves.
+
+#include "ExternalSort.hpp"
+#include "Pos.hpp"
+#include "Tablebase.hpp"
+#include "TranspositionTable.hpp"
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+#include <getopt.h>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using std::array;
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::string;
+using std::thread;
+using std::unique_ptr;
+using std::vector;
+
+static int num_threads = std::thread::hardware_concurrency();
+
+// positions read from a layer file at a time for parallel expansion
+static constexpr size_t BATCH_SIZE = 1 << 20;
+
+// Calls f(begin, end) on num_threads contiguous parts of [0, n).
+template<class F>
+static void parallel_for(uint64_t n, F f) {
+    vector<thread> threads;
+    for (int i=0; i<num_threads; i++) {
+	uint64_t begin = n*i/num_threads, end = n*(i+1)/num_threads;
+	threads.emplace_back([f, begin, end] { f(begin, end); });
+    }
+    for (auto &t : threads)
+	t.join();
+}
+
+// Results packed 4 per byte as in Tablebase.hpp.
+class PackedResultWriter {
+    RecordWriter<uint8_t> w;
+    uint8_t byte = 0;
+    uint64_t count = 0;
+public:
+    PackedResultWriter(const string &fname, bool compress)
+	: w(fname, compress, num_threads) {}
+    void put(TpResult r) {
+	set_packed_result(&byte, count%4, r);
+	if (++count%4 == 0) {
+	    w.put(byte);
+	    byte = 0;
+	}
+    }
+    void close() {
+	if (count%4)
+	    w.put(byte);
+	w.close();
+    }
+};
+
+class PackedResultReader {
+    RecordReader<uint8_t> r;
+    uint8_t byte = 0;
+    uint64_t count = 0;
+public:
+    PackedResultReader(const string &fname) : r(fname) {}
+    TpResult get() {
+	if (count%4 == 0 && !r.get(byte))
+	    abort();
+	return get_packed_result(&byte, count++%4);
+    }
+};
+
+struct Edge {
+    pos_t child;
+    uint64_t parent; // index in the parent layer
+    bool operator<(const Edge &a) const {
+	return child < a.child || (child == a.child && parent < a.parent);
+    }
+};
+
+// Results by parent index: index << 3 | LEAF_BIT | result. For leaves
+// the result is that of the position itself, otherwise of a child.
+static constexpr uint64_t LEAF_BIT = 4;
+
+class LayeredSolver {
+    const string dir;
+    const Tablebases &tablebases;
+    const uint64_t memory; // bytes
+    const bool compress;
+    array<uint64_t, MAX_PROGRESS+1> layer_sizes{{0}};
+
+    string layer_filename(int layer, const char *suffix) const {
+	return dir + "/layer" + std::to_string(layer) + suffix;
+    }
+
+    // sorter buffer size when MAX_PROGRESS_STEP+1 sorters are in use
+    template<class T>
+    size_t sorter_records() const {
+	return memory / (MAX_PROGRESS_STEP+1) / sizeof(T);
+    }
+
+    // Calls f(batch, first_index) for the positions of a layer in batches.
+    template<class F>
+    void for_batches(int layer, F f) const {
+	RecordReader<pos_t> in(layer_filename(layer, ".pos"));
+	vector<pos_t> batch;
+	uint64_t index = 0;
+	for (bool more = true; more; ) {
+	    batch.clear();
+	    pos_t pos;
+	    while (batch.size() < BATCH_SIZE && (more = in.get(pos)))
+		batch.push_back(pos);
+	    f(batch, index);
+	    index += batch.size();
+	}
+    }
+
+    // Returns the result of a leaf, or NONE if p is not one.
+    TpResult leaf_result(const Pos &p) const {
+	const TpResult tb = tablebases.probe(p);
+	if (tb != TpResult::NONE)
+	    return tb;
+	array<Pos::Move, MAX_LEGAL_MOVES> moves;
+	if (p.get_legal_moves(moves) > 0)
+	    return TpResult::NONE;
+	const int w = p.winner();
+	if (w == 1)
+	    return TpResult::CURRENT_WIN;
+	else if (w == -1)
+	    return TpResult::CURRENT_LOSS;
+	return TpResult::DRAW;
+    }
+
+    // Calls f(step, child) for the canonized children of p.
+    template<class F>
+    static void for_children(Pos &p, int layer, F f) {
+	array<Pos::Move, MAX_LEGAL_MOVES> moves;
+	const int num_moves = p.get_legal_moves(moves);
+	for (int j=0; j<num_moves; j++) {
+	    p.do_move(moves[j]);
+	    Pos child(p);
+	    p.undo_move(moves[j]);
+	    child.canonize();
+	    const int step = child.get_progress() - layer;
+	    assert(step >= 1 && step <= MAX_PROGRESS_STEP);
+	    f(step, child.pack());
+	}
+    }
+
+    // Writes the edges of layer k to edges and the results of its
+    // leaves to results.
+    void expand_edges(int k, array<unique_ptr<ExternalSorter<Edge>>, MAX_PROGRESS_STEP+1> &edges,
+		      ExternalSorter<uint64_t> &results) {
+	std::mutex mutex;
+	for_batches(k, [&](const vector<pos_t> &batch, uint64_t first) {
+		parallel_for(batch.size(), [&](uint64_t begin, uint64_t end) {
+			array<vector<Edge>, MAX_PROGRESS_STEP+1> local;
+			vector<uint64_t> leaves;
+			for (uint64_t i=begin; i<end; i++) {
+			    Pos p(batch[i]);
+			    const TpResult r = leaf_result(p);
+			    if (r != TpResult::NONE) {
+				leaves.push_back((first+i) << 3 | LEAF_BIT | static_cast<int>(r));
+				continue;
+			    }
+			    for_children(p, k, [&](int step, pos_t child) {
+				    local[step].push_back(Edge{child, first+i});
+				});
+			}
+			std::lock_guard<std::mutex> guard(mutex);
+			for (int step=1; step<=MAX_PROGRESS_STEP; step++)
+			    for (const Edge &e : local[step])
+				edges[step]->put(e);
+			for (uint64_t r : leaves)
+			    results.put(r);
+		    });
+	    });
+    }
+
+    // Looks up the children of one step in their layer.
+    void join_edges(int child_layer, ExternalSorter<Edge> &edges,
+		    ExternalSorter<uint64_t> &results) const {
+	if (edges.size() == 0)
+	    return;
+	RecordReader<pos_t> positions(layer_filename(child_layer, ".pos"));
+	PackedResultReader child_results(layer_filename(child_layer, ".res"));
+	pos_t pos = 0;
+	TpResult res = TpResult::NONE;
+	bool have = false;
+	edges.merge([&](const Edge &e) {
+		while (!have || pos < e.child) {
+		    if (!positions.get(pos))
+			break;
+		    res = child_results.get();
+		    have = true;
+		}
+		if (!have || pos != e.child) {
+		    cerr << "Position " << e.child << " missing from layer " << child_layer << endl;
+		    abort();
+		}
+		results.put(e.parent << 3 | static_cast<int>(res));
+	    }, false);
+    }
+
+    // Combines the results sorted by parent into the result file of layer k.
+    array<uint64_t, 4> combine(int k, ExternalSorter<uint64_t> &results) const {
+	PackedResultWriter out(layer_filename(k, ".res"), compress);
+	array<uint64_t, 4> counts{{0}};
+	uint64_t index = 0;
+	bool any = false, win = false, draw = false;
+	TpResult leaf = TpResult::NONE;
+	auto finish = [&] {
+	    TpResult r = leaf;
+	    if (r == TpResult::NONE)
+		r = win ? TpResult::CURRENT_WIN : draw ? TpResult::DRAW : TpResult::CURRENT_LOSS;
+	    out.put(r);
+	    counts[static_cast<int>(r)]++;
+	    index++;
+	    any = win = draw = false;
+	    leaf = TpResult::NONE;
+	};
+	results.merge([&](uint64_t rec) {
+		if (any && rec >> 3 != index)
+		    finish();
+		if (rec >> 3 != index) {
+		    cerr << "Layer " << k << ": no results for position " << index << endl;
+		    abort();
+		}
+		any = true;
+		const TpResult r = TpResult(rec & 3);
+		if (rec & LEAF_BIT)
+		    leaf = r;
+		else if (r == TpResult::CURRENT_LOSS)
+		    win = true;
+		else if (r == TpResult::DRAW)
+		    draw = true;
+	    }, false);
+	if (any)
+	    finish();
+	assert(index == layer_sizes[k]);
+	out.close();
+	return counts;
+    }
+
+public:
+    LayeredSolver(const string &dir, const Tablebases &tablebases, uint64_t memory,
+		  bool compress)
+	: dir(dir), tablebases(tablebases), memory(memory), compress(compress) {}
+
+    void forward() {
+	array<unique_ptr<ExternalSorter<pos_t>>, MAX_PROGRESS+1> pending;
+	auto pending_layer = [&](int layer) -> ExternalSorter<pos_t> & {
+	    if (!pending[layer])
+		pending[layer].reset(new ExternalSorter<pos_t>(
+					 layer_filename(layer, ".pending"),
+					 sorter_records<pos_t>(), compress, num_threads));
+	    return *pending[layer];
+	};
+	Pos start;
+	start.canonize();
+	pending_layer(start.get_progress()).put(start.pack());
+
+	for (int k=0; k<=MAX_PROGRESS; k++) {
+	    if (!pending[k])
+		continue;
+	    RecordWriter<pos_t> out(layer_filename(k, ".pos"), compress, num_threads);
+	    pending[k]->merge([&](pos_t pos) { out.put(pos); }, true);
+	    const uint64_t found = pending[k]->size();
+	    pending[k].reset();
+	    out.close();
+	    layer_sizes[k] = out.size();
+	    cout << "[" << time(NULL) << "] forward: layer " << k << ": " << out.size()
+		 << " positions (" << found - out.size() << " duplicates), "
+		 << out.get_stored_bytes() << " bytes" << endl;
+
+	    std::mutex mutex;
+	    for_batches(k, [&](const vector<pos_t> &batch, uint64_t) {
+		    parallel_for(batch.size(), [&](uint64_t begin, uint64_t end) {
+			    array<vector<pos_t>, MAX_PROGRESS_STEP+1> children;
+			    for (uint64_t i=begin; i<end; i++) {
+				Pos p(batch[i]);
+				if (leaf_result(p) != TpResult::NONE)
+				    continue;
+				for_children(p, k, [&](int step, pos_t child) {
+					children[step].push_back(child);
+				    });
+			    }
+			    std::lock_guard<std::mutex> guard(mutex);
+			    for (int step=1; step<=MAX_PROGRESS_STEP; step++) {
+				if (children[step].empty())
+				    continue;
+				ExternalSorter<pos_t> &s = pending_layer(k+step);
+				for (pos_t c : children[step])
+				    s.put(c);
+			    }
+			});
+		});
+	}
+    }
+
+    // Returns the result of the initial position.
+    TpResult backward() {
+	for (int k=MAX_PROGRESS; k>=0; k--) {
+	    if (layer_sizes[k] == 0)
+		continue;
+	    array<unique_ptr<ExternalSorter<Edge>>, MAX_PROGRESS_STEP+1> edges;
+	    for (int step=1; step<=MAX_PROGRESS_STEP; step++)
+		edges[step].reset(new ExternalSorter<Edge>(
+				      layer_filename(k, ".edges") + std::to_string(step),
+				      sorter_records<Edge>(), compress, num_threads));
+	    ExternalSorter<uint64_t> results(layer_filename(k, ".results"),
+					     sorter_records<uint64_t>(), compress, num_threads);
+	    expand_edges(k, edges, results);
+	    for (int step=1; step<=MAX_PROGRESS_STEP; step++) {
+		join_edges(k+step, *edges[step], results);
+		edges[step].reset();
+	    }
+	    const array<uint64_t, 4> counts = combine(k, results);
+	    cout << "[" << time(NULL) << "] backward: layer " << k << ": " << counts[3]
+		 << " wins, " << counts[2] << " draws, " << counts[1] << " losses" << endl;
+	}
+
+	Pos start;
+	start.canonize();
+	const int k = start.get_progress();
+	RecordReader<pos_t> positions(layer_filename(k, ".pos"));
+	PackedResultReader results(layer_filename(k, ".res"));
+	pos_t pos;
+	while (positions.get(pos)) {
+	    const TpResult r = results.get();
+	    if (pos == start.pack())
+		return r;
+	}
+	cerr << "Initial position missing from layer " << k << endl;
+	abort();
+    }
+};
+
+static void usage(const char *argv0) {
+    cerr << "Usage: " << argv0 << " [options] DIR\n"
+	 << "Solves the game by layers, keeping the layer files in DIR.\n"
+	 << "  -j, --threads N       number of threads (default: number of CPUs)\n"
+	 << "  -t, --tablebases DIR  probe tablebases in DIR\n"
+	 << "  -k, --tb-pawns K      use tablebases for up to K pawns (default: 5)\n"
+	 << "  -m, --memory MB       memory for sorting (default: 1024)\n"
+	 << "  -z, --compress        compress the layer and temporary files\n";
+}
+
+int main(int argc, char **argv) {
+    static const struct option long_options[] = {
+	{"threads", required_argument, nullptr, 'j'},
+	{"tablebases", required_argument, nullptr, 't'},
+	{"tb-pawns", required_argument, nullptr, 'k'},
+	{"memory", required_argument, nullptr, 'm'},
+	{"compress", no_argument, nullptr, 'z'},
+	{"help", no_argument, nullptr, 'h'},
+	{nullptr, 0, nullptr, 0}
+    };
+    string tb_dir;
+    int tb_pawns = 5;
+    uint64_t memory_mb = 1024;
+    bool compress = false;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "j:t:k:m:zh", long_options, nullptr)) != -1) {
+	switch (opt) {
+	case 'j':
+	    num_threads = atoi(optarg);
+	    break;
+	case 't':
+	    tb_dir = optarg;
+	    break;
+	case 'k':
+	    tb_pawns = atoi(optarg);
+	    break;
+	case 'm':
+	    memory_mb = atoll(optarg);
+	    break;
+	case 'z':
+	    compress = true;
+	    break;
+	case 'h':
+	    usage(argv[0]);
+	    return 0;
+	default:
+	    usage(argv[0]);
+	    return 1;
+	}
+    }
+    if (optind != argc-1 || num_threads < 1) {
+	usage(argv[0]);
+	return 1;
+    }
+
+    Tablebases tablebases;
+    if (!tb_dir.empty())
+	tablebases.load(tb_dir, tb_pawns);
+
+    LayeredSolver solver(argv[optind], tablebases, memory_mb << 20, compress);
+    solver.forward();
+    const TpResult res = solver.backward();
+    cout << "result="
+	 << (res == TpResult::CURRENT_WIN ? 1 : res == TpResult::CURRENT_LOSS ? -1 : 0) << endl;
+}
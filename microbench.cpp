@@ -0,0 +1,247 @@
+// Copyright (C) 2016  Sami Liedes
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+// Measures the per-node primitives of the search in ns/op over a fixed
+// batch of random positions, so that a regression in one of them shows
+// up even when the end-to-end time of bench.py hides it. The batch is
+// made with Pos::random_position() from a fixed seed, so runs with the
+// same arguments measure the same work.
+
+#include "MemTranspositionTable.hpp"
+#include "Pos.hpp"
+#include "binom.hpp"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <getopt.h>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+using std::array;
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::vector;
+
+static constexpr unsigned DEFAULT_SEED = 1;
+static constexpr int DEFAULT_POSITIONS = 1 << 16;
+// every primitive is run over the batch until this much time has passed
+static constexpr double MIN_SECONDS = 0.5;
+static constexpr size_t TP_TABLE_SIZE = 1 << 24;
+
+// keeps the compiler from optimizing the measured calls away
+static volatile uint64_t sink;
+
+// Calls f() until MIN_SECONDS has passed and prints the time per op,
+// f() doing ops_per_call ops.
+template<class F>
+static void measure(const char *name, uint64_t ops_per_call, F f) {
+    f(); // warm up
+    uint64_t calls = 0;
+    double secs;
+    const auto start = std::chrono::steady_clock::now();
+    do {
+	f();
+	calls++;
+	secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    } while (secs < MIN_SECONDS);
+    printf("%-28s %10.2f ns/op\n", name, secs*1e9/(calls*ops_per_call));
+}
+
+static void usage(const char *argv0) {
+    cerr << "Usage: " << argv0 << " [-s SEED] [-n POSITIONS]\n";
+}
+
+int main(int argc, char **argv) {
+    unsigned seed = DEFAULT_SEED;
+    int num_positions = DEFAULT_POSITIONS;
+    int opt;
+    while ((opt = getopt(argc, argv, "s:n:h")) != -1) {
+	switch (opt) {
+	case 's':
+	    seed = atoi(optarg);
+	    break;
+	case 'n':
+	    num_positions = atoi(optarg);
+	    break;
+	default:
+	    usage(argv[0]);
+	    return opt == 'h' ? 0 : 1;
+	}
+    }
+    if (num_positions <= 0) {
+	usage(argv[0]);
+	return 1;
+    }
+
+    // the search only sees canonical positions, so the primitives
+    // except canonize() get those
+    srand(seed);
+    vector<Pos> uncanonized(num_positions), positions(num_positions);
+    vector<pos_t> packed(num_positions);
+    for (int i=0; i<num_positions; i++) {
+	uncanonized[i].random_position();
+	positions[i] = uncanonized[i];
+	positions[i].canonize();
+	positions[i] = Pos(positions[i].pack());
+	packed[i] = positions[i].pack();
+    }
+
+    // combinations of the sizes pack() ranks
+    vector<array<int, N>> combinations(num_positions);
+    vector<int> combination_sizes(num_positions);
+    vector<uint64_t> combination_ranks(num_positions);
+    for (int i=0; i<num_positions; i++) {
+	const int k = 1 + rand()%N;
+	array<int, NUM_ISQ> squares;
+	for (int j=0; j<NUM_ISQ; j++)
+	    squares[j] = j;
+	for (int j=0; j<k; j++)
+	    std::swap(squares[j], squares[j + rand()%(NUM_ISQ-j)]);
+	std::sort(squares.begin(), squares.begin()+k);
+	std::copy(squares.begin(), squares.begin()+k, combinations[i].begin());
+	combination_sizes[i] = k;
+	combination_ranks[i] = rank_combination(&combinations[i][0], k);
+    }
+
+    uint64_t num_moves = 0;
+    for (const Pos &p : positions) {
+	array<Pos::Move, MAX_LEGAL_MOVES> moves;
+	num_moves += p.get_legal_moves(moves);
+    }
+
+    cout << N << "x" << N << " board, " << num_positions << " positions (seed " << seed
+	 << "), " << num_moves/double(num_positions) << " legal moves per position" << endl;
+
+    measure("get_legal_moves", num_positions, [&] {
+	    uint64_t n = 0;
+	    for (const Pos &p : positions) {
+		array<Pos::Move, MAX_LEGAL_MOVES> moves; // as in the search
+		n += p.get_legal_moves(moves);
+	    }
+	    sink = n;
+	});
+
+    measure("do_move+undo_move", num_moves, [&] {
+	    for (Pos &p : positions) {
+		array<Pos::Move, MAX_LEGAL_MOVES> moves;
+		const int n = p.get_legal_moves(moves);
+		for (int i=0; i<n; i++) {
+		    p.do_move(moves[i]);
+		    p.undo_move(moves[i]);
+		}
+	    }
+	});
+    // subtract this from the above to get do_move+undo_move alone
+    measure("  (get_legal_moves per move)", num_moves, [&] {
+	    uint64_t n = 0;
+	    for (const Pos &p : positions) {
+		array<Pos::Move, MAX_LEGAL_MOVES> moves; // as in the search
+		n += p.get_legal_moves(moves);
+	    }
+	    sink = n;
+	});
+
+    measure("Pos copy", num_positions, [&] {
+	    uint64_t n = 0;
+	    for (const Pos &p : uncanonized) {
+		Pos q(p);
+		n += q.get_turn();
+	    }
+	    sink = n;
+	});
+
+    // includes a Pos copy
+    measure("canonize", num_positions, [&] {
+	    uint64_t n = 0;
+	    for (const Pos &p : uncanonized) {
+		Pos q(p);
+		q.canonize();
+		n += q.get_turn();
+	    }
+	    sink = n;
+	});
+
+    measure("is_horiz_symmetric", num_positions, [&] {
+	    uint64_t n = 0;
+	    for (const Pos &p : positions)
+		n += p.is_horiz_symmetric();
+	    sink = n;
+	});
+
+    measure("pack", num_positions, [&] {
+	    uint64_t n = 0;
+	    for (const Pos &p : positions)
+		n += p.pack();
+	    sink = n;
+	});
+
+    measure("Pos(pos_t)", num_positions, [&] {
+	    uint64_t n = 0;
+	    for (pos_t packed_pos : packed)
+		n += Pos(packed_pos).get_turn();
+	    sink = n;
+	});
+
+    measure("rank_combination", num_positions, [&] {
+	    uint64_t n = 0;
+	    for (int i=0; i<num_positions; i++)
+		n += rank_combination(&combinations[i][0], combination_sizes[i]);
+	    sink = n;
+	});
+
+    measure("unrank_combination", num_positions, [&] {
+	    array<int, N> cs;
+	    uint64_t n = 0;
+	    for (int i=0; i<num_positions; i++) {
+		unrank_combination(&cs[0], combination_sizes[i], combination_ranks[i]);
+		n += cs[0];
+	    }
+	    sink = n;
+	});
+
+    // The table only takes positions below CAPACITY << POS_BITS, so
+    // the keys are reduced into that range; they are only keys here.
+    auto tp_table = std::make_unique<MemTranspositionTable<TP_TABLE_SIZE>>();
+    vector<uint64_t> keys(packed);
+    for (uint64_t &k : keys)
+	k %= uint64_t(TP_TABLE_SIZE) << TranspositionTableBase::POS_BITS;
+
+    measure("tp_table.probe (miss)", num_positions, [&] {
+	    uint64_t n = 0;
+	    for (uint64_t k : keys)
+		n += static_cast<int>(tp_table->probe(k));
+	    sink = n;
+	});
+
+    measure("tp_table.add", num_positions, [&] {
+	    for (size_t i=0; i<keys.size(); i++)
+		tp_table->add(keys[i], TpResult(1 + i%3));
+	});
+
+    measure("tp_table.probe (hit)", num_positions, [&] {
+	    uint64_t n = 0;
+	    for (uint64_t k : keys)
+		n += static_cast<int>(tp_table->probe(k));
+	    sink = n;
+	});
+
+    return 0;
+}
@@ -0,0 +1,218 @@
+// Copyright (C) 2016  Sami Liedes
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+// Learns move ordering scores from the tablebases. Every position of
+// the classes with at most MAX_PAWNS pawns is expanded and its moves
+// are scored by the exact results of the children; in positions where
+// not all moves are equally good, each move counts as seen in the cell
+// of its Pos::MoveFeatures and, if it is one of the best moves, as
+// best there. The score of a cell is the smoothed share of best moves,
+// (best+1)/(seen+2) per mille, and the table is printed as a block for
+// MoveScores.hpp.
+
+#include "MoveScores.hpp"
+#include "Pos.hpp"
+#include "Tablebase.hpp"
+#include "TightIndex.hpp"
+#include "TranspositionTable.hpp"
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+#include <getopt.h>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+using std::array;
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::string;
+using std::thread;
+using std::vector;
+
+static int num_threads = std::thread::hardware_concurrency();
+
+struct Counts {
+    uint64_t positions = 0; // with a choice of result
+    uint64_t moves = 0;
+    array<array<array<array<uint64_t, 2>, NUM_FILE_CENTRALITIES>, NUM_RANKS>,
+	  Pos::NUM_MOVE_KINDS> seen{}, best{};
+
+    Counts &operator+=(const Counts &a) {
+	positions += a.positions;
+	moves += a.moves;
+	for (int k=0; k<Pos::NUM_MOVE_KINDS; k++)
+	    for (int r=0; r<NUM_RANKS; r++)
+		for (int c=0; c<NUM_FILE_CENTRALITIES; c++)
+		    for (int u=0; u<2; u++) {
+			seen[k][r][c][u] += a.seen[k][r][c][u];
+			best[k][r][c][u] += a.best[k][r][c][u];
+		    }
+	return *this;
+    }
+};
+
+// result of a canonical position for the side to move
+static int result_of(const Tablebases &tablebases, const Pos &p) {
+    switch (tablebases.probe(p)) {
+    case TpResult::CURRENT_LOSS:
+	return -1;
+    case TpResult::DRAW:
+	return 0;
+    case TpResult::CURRENT_WIN:
+	return 1;
+    default:
+	cerr << "Position not in the tablebases:" << endl;
+	p.print(cerr);
+	abort();
+    }
+}
+
+// p must be canonical
+static void count_position(const Tablebases &tablebases, Pos &p, Counts &counts) {
+    array<Pos::Move, MAX_LEGAL_MOVES> moves;
+    const int num_moves = p.get_legal_moves(moves);
+    array<int, MAX_LEGAL_MOVES> values;
+    int best = -1, worst = 1;
+    for (int i=0; i<num_moves; i++) {
+	p.do_move(moves[i]);
+	Pos child(p);
+	p.undo_move(moves[i]);
+	child.canonize();
+	values[i] = -result_of(tablebases, child);
+	best = std::max(best, values[i]);
+	worst = std::min(worst, values[i]);
+    }
+    if (num_moves == 0 || best == worst)
+	return;
+
+    counts.positions++;
+    counts.moves += num_moves;
+    for (int i=0; i<num_moves; i++) {
+	const Pos::MoveFeatures f = p.move_features(moves[i]);
+	counts.seen[f.kind][f.rank][f.file_centrality][f.unstoppable]++;
+	if (values[i] == best)
+	    counts.best[f.kind][f.rank][f.file_centrality][f.unstoppable]++;
+    }
+}
+
+static Counts count_class(const Tablebases &tablebases, int nw, int nb) {
+    const uint64_t size = tight_index.size(nw, nb);
+    Counts total;
+    std::mutex total_mutex;
+    vector<thread> threads;
+    for (int t=0; t<num_threads; t++)
+	threads.emplace_back([&, t] {
+		Counts counts;
+		for (uint64_t idx=size*t/num_threads; idx<size*(t+1)/num_threads; idx++) {
+		    Pos p = tight_index.position(nw, nb, idx);
+		    if (tight_index.index(p) != idx)
+			continue; // unused index
+		    p.canonize();
+		    count_position(tablebases, p, counts);
+		}
+		std::lock_guard<std::mutex> guard(total_mutex);
+		total += counts;
+	    });
+    for (auto &t : threads)
+	t.join();
+    return total;
+}
+
+static const char *const KIND_NAMES[Pos::NUM_MOVE_KINDS] = {
+    "push", "double push", "capture", "en passant"
+};
+
+static void print_table(const Counts &counts, int max_pawns) {
+    cout << "#if BOARD_N == " << N << "\n"
+	 << "// movestats, " << max_pawns << " pawns: " << counts.positions
+	 << " positions with a choice, " << counts.moves << " moves\n"
+	 << "#define HAVE_MOVE_SCORES\n"
+	 << "static constexpr MoveScoreTable MOVE_SCORES = {\n";
+    for (int k=0; k<Pos::NUM_MOVE_KINDS; k++) {
+	cout << "    { // " << KIND_NAMES[k] << "; by rank, file centrality, unstoppable\n";
+	for (int r=0; r<NUM_RANKS; r++) {
+	    cout << "\t{";
+	    for (int c=0; c<NUM_FILE_CENTRALITIES; c++) {
+		cout << (c ? ", " : "") << "{";
+		for (int u=0; u<2; u++)
+		    cout << (u ? ", " : "")
+			 << (counts.best[k][r][c][u]+1)*1000/(counts.seen[k][r][c][u]+2);
+		cout << "}";
+	    }
+	    cout << "},\n";
+	}
+	cout << "    },\n";
+    }
+    cout << "};\n"
+	 << "#endif" << endl;
+}
+
+static void usage(const char *argv0) {
+    cerr << "Usage: " << argv0 << " [options] TB_DIR MAX_PAWNS\n"
+	 << "Prints move ordering scores for MoveScores.hpp, learned from the\n"
+	 << "tablebases in TB_DIR of all classes with at most MAX_PAWNS pawns.\n"
+	 << "  -j, --threads N     number of threads (default: number of CPUs)\n";
+}
+
+int main(int argc, char **argv) {
+    static const struct option long_options[] = {
+	{"threads", required_argument, nullptr, 'j'},
+	{"help", no_argument, nullptr, 'h'},
+	{nullptr, 0, nullptr, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "j:h", long_options, nullptr)) != -1) {
+	switch (opt) {
+	case 'j':
+	    num_threads = atoi(optarg);
+	    break;
+	case 'h':
+	    usage(argv[0]);
+	    return 0;
+	default:
+	    usage(argv[0]);
+	    return 1;
+	}
+    }
+    if (optind != argc-2 || num_threads < 1) {
+	usage(argv[0]);
+	return 1;
+    }
+    const string tb_dir = argv[optind];
+    const int max_pawns = atoi(argv[optind+1]);
+    if (max_pawns < 2 || max_pawns > 2*N) {
+	cerr << "MAX_PAWNS must be between 2 and " << 2*N << endl;
+	return 1;
+    }
+
+    Tablebases tablebases;
+    tablebases.load(tb_dir, max_pawns);
+
+    Counts counts;
+    for (int nw=1; nw<=N; nw++)
+	for (int nb=1; nb<=N && nw+nb<=max_pawns; nb++) {
+	    counts += count_class(tablebases, nw, nb);
+	    cerr << "[" << time(NULL) << "] class " << nw << "+" << nb << ": "
+		 << counts.positions << " positions with a choice so far" << endl;
+	}
+    print_table(counts, max_pawns);
+}
@@ -14,12 +14,27 @@
 // with this program; if not, write to the Free Software Foundation, Inc.,
 // 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
 
+#include "CachedTranspositionTable.hpp"
+#include "ClassEnumerator.hpp"
+#include "HybridTranspositionTable.hpp"
+#include "LocalTranspositionTable.hpp"
+#include "BestMoveTable.hpp"
 #include "MemTranspositionTable.hpp"
+#include "MoveOrdering.hpp"
+#include "PerfCounters.hpp"
+#include "Pos.hpp"
+#include "ProgressLog.hpp"
+#include "ReachableTranspositionTable.hpp"
+#include "SearchCounters.hpp"
+#include "Tablebase.hpp"
+#include "TightIndex.hpp"
+#include "TreeStats.hpp"
 #include "binom.hpp"
 #include <algorithm>
 #include <array>
 #include <atomic>
 #include <cassert>
+#include <chrono>
 #include <cmath>
 #include <condition_variable>
 #include <cstdint>
@@ -27,31 +42,61 @@
 #include <cstring>
 #include <ctime>
 #include <fstream>
+#include <getopt.h>
 #include <iomanip>
 #include <iostream>
+#include <memory>
 #include <mutex>
 #include <signal.h>
 #include <sstream>
+#include <sys/resource.h>
 #include <thread>
 #include <vector>
 
-static constexpr bool DEBUG = true;
-
-// static constexpr int N = 7;
+// Tuned for BOARD_N = 8 (see Pos.hpp). For BOARD_N = 7:
 // static constexpr int VERBOSE_DEPTH = 3;
 // static constexpr int PARALLEL_DEPTH = 10;
 // static constexpr int CUT_MIN_DEPTH = 0;
 // static constexpr int PARALLEL_MIN_DEPTH = 0;
 // static constexpr size_t TP_TABLE_SIZE = 671088637; // 2.5 gigabytes
 
-static constexpr int N = 8;
 static constexpr int VERBOSE_DEPTH = 8;
 static constexpr int PARALLEL_DEPTH = 18;
 static constexpr int CUT_MIN_DEPTH = 4;
 static constexpr int PARALLEL_MIN_DEPTH = 3;
+#ifdef TP_TABLE_ENTRIES
+// e.g. -DTP_TABLE_ENTRIES=30146531 for benchmark builds (see bench.py)
+static constexpr size_t TP_TABLE_SIZE = TP_TABLE_ENTRIES;
+#else
 static constexpr size_t TP_TABLE_SIZE = 6710886419; // 25 gigabytes
+#endif
+
+// Material classes with at most this many white-to-move indices get a
+// dense region of exact slots in front of the hashed table, 8/3 bits
+// per index; for BOARD_N = 8 that is 20 classes in 150 megabytes.
+static constexpr uint64_t DENSE_MAX_CLASS_SIZE = 1 << 27;
+
+static constexpr int DEFAULT_THREADS = 8;
+
+// Per-thread L1 table in front of the shared one; 8-byte elements,
+// small enough to stay in L2 cache. Results of subtrees smaller than
+// L1_PROMOTE_MIN_NODES nodes are only stored in L1.
+static constexpr size_t L1_TABLE_SIZE = 16381; // 128 kilobytes
+static constexpr uint64_t L1_PROMOTE_MIN_NODES = 4;
+
+// With --best-moves, the best moves of subtrees of at least
+// BEST_MOVE_MIN_NODES nodes go to a table of 2-byte entries, one for
+// every 8 entries of the shared table (+6% memory).
+static constexpr size_t BEST_MOVE_TABLE_SIZE = TP_TABLE_SIZE/8;
+static constexpr uint64_t BEST_MOVE_MIN_NODES = L1_PROMOTE_MIN_NODES;
+
+// default for --tb-pawns
+static constexpr int DEFAULT_TB_PAWNS = 5;
 
-static constexpr int NUM_THREADS = 8;
+// seconds between throughput reports; 0 = no reports
+static constexpr int REPORT_INTERVAL = 60;
+// also print the performance counters (-DPERF_COUNTERS) in them
+static constexpr bool PERF_PERIODIC_REPORT = true;
 
 //#define SAVE_NODES_LIMIT 50
 //static constexpr int SAVE_LEVELS = 1;
@@ -87,27 +132,6 @@ using std::vector;
 
 static mutex cout_mutex;
 
-// number of internal ranks (i.e. those on which pawns can be
-// without the game being over)
-static constexpr int NUM_RANKS = N-2;
-
-// number of internal squares
-static constexpr int NUM_ISQ = N*NUM_RANKS;
-
-// starting ranks
-static constexpr int RANK_WHITE = 0;
-static constexpr int RANK_BLACK = NUM_RANKS-1;
-
-// a pawn must be in one of these ranks to even be candidate for en passant
-static constexpr int EP_RANK_WHITE = RANK_WHITE+2;
-static constexpr int EP_RANK_BLACK = RANK_BLACK-2;
-
-// tighter limit? N*2 is not enough
-static constexpr int MAX_LEGAL_MOVES = N*3;
-
-// compactly represented position
-typedef uint64_t pos_t;
-
 class Timer {
     time_t start;
 public:
@@ -119,818 +143,6 @@ static ostream &operator<<(ostream &str, const Timer &t) {
     return str << "[" << t.elapsed() << "]";
 }
 
-static const int flip_horiz_sq(int sq) {
-    int rank = sq/N, file = sq%N;
-    return rank*N + (N-1-file);
-}
-
-static const char *player_name(int player) {
-    if (player == 1)
-	return "White";
-    else if (player == -1)
-	return "Black";
-    else
-	abort();
-}
-
-static void assert_valid_sq(int x, int y) {
-    assert(x >= 0);
-    assert(x < N);
-    assert(y >= 0);
-    assert(y < N-2);
-}
-
-static const int SQ(int x, int y) {
-    assert_valid_sq(x, y);
-    return y*N+x;
-}
-
-static string sqname(int x, int y) {
-    assert_valid_sq(x, y);
-    stringstream sb;
-    assert(N < 26);
-    sb << (char)('a'+x);
-    sb << 2+y;
-    return sb.str();
-}
-
-static string sqname(int sq) {
-    assert(sq >= 0);
-    assert(sq < NUM_ISQ);
-    return sqname(sq%N, sq/N);
-}
-
-// Singleton
-class Compact_tab {
-private:
-    static Compact_tab *instance;
-    static constexpr int SIZE = (N+1)*(N+1);
-    array<uint64_t, SIZE> tab;
-public:
-    Compact_tab();
-    uint64_t operator[](int n) const {
-	assert(n >= 0);
-	assert(n < SIZE);
-	return tab[n];
-    }
-    uint64_t base(int nwhite, int nblack) const {
-	assert(nwhite >= 0 && nwhite <= N);
-	assert(nblack >= 0 && nblack <= N);
-	assert(nwhite != 0 || nblack != 0);
-	return tab[nwhite*(N+1)+nblack-1];
-    }
-    int num_white(int idx) const { return (idx+1)/(N+1); }
-    int num_black(int idx) const { return (idx+1)%(N+1); }
-    // returns the index of the last element <= n
-    int find(uint64_t n) const {
-	return std::upper_bound(&tab[0], &tab[SIZE], n) - tab.begin() - 1;
-    }
-} ranks_tab;
-
-Compact_tab *Compact_tab::instance = nullptr;
-
-Compact_tab::Compact_tab() {
-    instance = this;
-
-    init_binom();
-
-    int p = 0;
-    tab[p++] = 0;
-    for (int white=0; white<=N; white++)
-	for (int black=0; black<=N; black++) {
-	    if (white == 0 && black == 0)
-		continue;
-	    // cout << "[" << p-1 << "]: " << white << "+" << black << ": "
-	    // 	 << binom(NUM_ISQ, white) * binom(NUM_ISQ, black) * 2 << endl;
-	    tab[p] = tab[p-1] + binom(NUM_ISQ, white) * binom(NUM_ISQ, black) * 2 * (N+1);
-	    p++;
-	}
-    assert(p == SIZE);
-    assert(tab[p-1] >> 62 == 0);
-}
-
-class Pos {
-    array<int, NUM_ISQ> sq; // 1 = white, -1 = black, 0 = empty
-    int turn; // 1 = white, -1 = black
-    mutable int num_white = -1, num_black = -1; // calculated if/when needed
-    int canonized_player_flip; // -1 changed player in canonize, else 1
-    bool horiz_flipped;
-    int ep_file; // en passant; -1 = no ep
-    void force_count_pieces() const;
-    void count_pieces() const { if (num_white == -1) force_count_pieces(); }
-    void clear();
-    // check if a hypothetical pawn at a square is unstoppable
-    bool is_unstoppable(int sq) const;
-public:
-    struct Move {
-	// 'replacing' = the contents of the square moved to
-	// (so this information is enough to undo the move).
-	int from, to, replacing, value;
-	int new_ep_file, old_ep_file, ep_square;
-
-	// Move(int from, int to, int replacing, int value, int ep_square=-1)
-	//     : from(from), to(to), replacing(replacing), value(value), ep_square(ep_square)
-	// {}
-
-	Move() : from(-1), to(-1), replacing(-100), value(-9999999), new_ep_file(-1),
-		 old_ep_file(-9999999), ep_square(-1) {}
-
-	// used to remove symmetric moves if Pos::is_horiz_symmetric() returns true
-	bool is_from_right_half() const { return from >= (N+1)/2; }
-
-	Move decanonize(bool black, bool flip_horiz) const {
-	    Move m(*this);
-	    int from = this->from, to = this->to, replacing = this->replacing;
-	    int old_ep_f = old_ep_file, new_ep_f = new_ep_file, ep_sq = ep_square;
-	    if (black) {
-		from = NUM_ISQ-1-from;
-		to = NUM_ISQ-1-to;
-		if (old_ep_f != -1)
-		    old_ep_f = N-1-old_ep_f;
-		if (new_ep_f != -1)
-		    new_ep_f = N-1-new_ep_f;
-		if (ep_sq != -1)
-		    ep_sq = NUM_ISQ-1-ep_sq;
-		replacing = -replacing;
-	    }
-	    if (flip_horiz) {
-		from = flip_horiz_sq(from);
-		to = flip_horiz_sq(to);
-		if (old_ep_f != -1)
-		    old_ep_f = N-1-old_ep_f;
-		if (new_ep_f != -1)
-		    new_ep_f = N-1-new_ep_f;
-		if (ep_sq != -1)
-		    ep_sq = flip_horiz_sq(ep_sq);
-	    }
-	    m.from = from;
-	    m.to = to;
-	    m.replacing = replacing;
-	    m.old_ep_file = old_ep_f;
-	    m.new_ep_file = new_ep_f;
-	    m.ep_square = ep_sq;
-	    return m;
-	}
-
-	string name() const {
-	    int from_file = from%N, from_rank = from/N,
-		to_file = to%N, to_rank = to/N;
-	    assert(from_file >= 0);
-	    assert(from_file < N);
-	    assert(from_rank >= 0);
-	    assert(from_rank < NUM_RANKS);
-
-	    stringstream ss;
-	    ss << ('a'+from_file) << ('1'+from_rank);
-	    if (replacing)
-		ss << 'x';
-	    else if (ep_square != -1)
-		ss << "(ep)";
-	    ss << ('a'+to_file) << ('1'+to_rank);
-	    return ss.str();
-	}
-    };
-
-    Pos(); // initial position
-    Pos(pos_t);
-    pos_t pack() const;
-    void check_sanity();
-    ostream &print(ostream &str) const;
-    void random_position();
-    void random_position(int nwhites, int nblacks);
-    int get_turn() const { return turn*canonized_player_flip; }
-    void canonize();
-    void horiz_mirror_board();
-    bool is_horiz_symmetric() const;
-
-    int winner() const; // -1 if won by black, 1 if by white, 0 otherwise
-    int get_canonize_flip() const { return canonized_player_flip; }
-    bool get_horiz_flipped() const { return horiz_flipped; }
-
-    // Returns count.
-    int get_legal_moves(array<Move, MAX_LEGAL_MOVES> &moves) const;
-
-    void do_move(const Move &move);
-    void undo_move(const Move &move);
-
-    bool operator==(const Pos &) const;
-};
-
-// check if a hypothetical pawn at a square is unstoppable
-bool Pos::is_unstoppable(int s) const {
-    int file = s%N;
-    if (file != 0 && file != N-1) {
-	if (turn == 1) {
-	    for (int s2=s+N; s2<NUM_ISQ; s2+=N)
-		if (sq[s2-1] != 0 || sq[s2] != 0 || sq[s2+1] != 0)
-		    return false;
-	} else
-	    for (int s2=s-N; s2>=0; s2-=N)
-		if (sq[s2-1] != 0 || sq[s2] != 0 || sq[s2+1] != 0)
-		    return false;
-    } else {
-	int othersq;
-	if (file == 0)
-	    othersq = 1;
-	else
-	    othersq = -1;
-	if (turn == 1) {
-	    for (int s2=s+N; s2<NUM_ISQ; s2+=N)
-		if (sq[s2] != 0 || sq[s2+othersq] != 0)
-		    return false;
-	} else
-	    for (int s2=s-N; s2>=0; s2-=N)
-		if (sq[s2] != 0 || sq[s2+othersq] != 0)
-		    return false;
-    }
-    return true;
-}
-
-bool Pos::is_horiz_symmetric() const {
-    int left = 0, right = N-1;
-
-    while (left < right) {
-	for (int i=0; i<NUM_ISQ; i+=N)
-	    if (sq[left+i] != sq[right+i])
-		return false;
-	left++;
-	right--;
-    }
-    return true;
-}
-
-void Pos::horiz_mirror_board() {
-    int left = 0, right = N-1;
-
-    while (left < right) {
-	for (int i=0; i<NUM_ISQ; i+=N) {
-	    int tmp = sq[left+i];
-	    sq[left+i] = sq[right+i];
-	    sq[right+i] = tmp;
-	}
-	left++;
-	right--;
-    }
-
-    if (ep_file != -1)
-	ep_file = N-1-ep_file;
-
-    horiz_flipped = !horiz_flipped;
-    //check_sanity();
-}
-
-void Pos::canonize() {
-    // Canonize so that white is always to move
-    if (turn == -1) {
-	turn = 1;
-	canonized_player_flip = -canonized_player_flip;
-	for (int from=0, to=NUM_ISQ-1; from < to; from++, to--) {
-	    int tmp = sq[from];
-	    sq[from] = -sq[to];
-	    sq[to] = -tmp;
-	}
-	if (NUM_ISQ%2 == 1)
-	    sq[NUM_ISQ/2] = -sq[NUM_ISQ/2];
-	int tmp = num_white;
-	num_white = num_black;
-	num_black = tmp;
-	if (ep_file != -1)
-	    ep_file = N-1-ep_file;
-	//check_sanity();
-    }
-
-    // Now possibly mirror the board horizontally
-    bool horiz_done = false;
-    for (int y=0; y<NUM_RANKS && !horiz_done; y++) {
-	int left = SQ(0,y);
-	int right = left+N-1;
-	while (left < right) {
-	    if (sq[left] < sq[right]) {
-		horiz_mirror_board();
-		horiz_done = true;
-		break;
-	    } else if (sq[left] > sq[right]) {
-		horiz_done = true;
-		break;
-	    } else {
-		left++;
-		right--;
-	    }
-	}
-    }
-}
-
-ostream &operator<<(ostream &os, const Pos::Move &move) {
-    os << sqname(move.from);
-    if (move.replacing)
-	os << "x";
-    os << sqname(move.to);
-    return os;
-}
-
-void Pos::do_move(const Move &move) {
-    assert(num_white >= 0 && num_black >= 0);
-
-    assert(sq[move.from] == turn);
-    assert(sq[move.to] == move.replacing);
-    sq[move.from] = 0;
-    sq[move.to] = turn;
-
-    bool captured = false;
-
-    if (move.replacing) {
-	assert(move.replacing == -turn);
-	captured = true;
-    } else if (move.ep_square != -1) {
-	assert(sq[move.ep_square] == -turn);
-	sq[move.ep_square] = 0;
-	captured = true;
-    }
-
-    if (captured) {
-	if (turn == 1)
-	    num_black--;
-	else
-	    num_white--;
-    }
-
-    assert(ep_file == move.old_ep_file);
-    ep_file = move.new_ep_file;
-
-    turn = -turn;
-}
-
-void Pos::undo_move(const Move &move) {
-    turn = -turn;
-    assert(sq[move.to] == turn);
-    assert(sq[move.from] == 0);
-    sq[move.from] = turn;
-    sq[move.to] = move.replacing;
-
-    bool captured = false;
-
-    if (move.replacing) {
-	assert(move.replacing == -turn);
-	captured = true;
-    } else if (move.ep_square != -1) {
-	assert(sq[move.ep_square] == 0);
-	sq[move.ep_square] = -turn;
-	captured = true;
-    }
-
-    if (captured) {
-	if (turn == 1)
-	    num_black++;
-	else
-	    num_white++;
-    }
-
-    assert(ep_file == move.new_ep_file);
-    ep_file = move.old_ep_file;
-}
-
-int Pos::get_legal_moves(array<Pos::Move, MAX_LEGAL_MOVES> &moves) const {
-    array<int, N> positions;
-    int num_pawns = 0, num_moves = 0;
-
-    //print(cerr);
-
-    if (winner() != 0)
-	return 0;
-
-    // for (int i=0; i<MAX_LEGAL_MOVES; i++)
-    // 	moves[i].value = 999;
-
-    // try to return potentially more useful moves first
-    if (turn == -1) {
-	for (int i=0; i<NUM_ISQ; i++)
-	    if (sq[i] == turn)
-		positions[num_pawns++] = i;
-    } else {
-	for (int i=NUM_ISQ-1; i>=0; i--)
-	    if (sq[i] == turn)
-		positions[num_pawns++] = i;
-    }
-
-    assert(num_pawns <= N);
-
-    // evaluation function: sum of ranks of pawns squared +
-    // 100*(2+rank) for best unstoppable pawn
-
-    int best_unstoppable = -1, best_unstoppable_rank = -1;
-
-    for (int i=0; i<num_pawns; i++) {
-	int s = positions[i], file = s%N;
-	int file_centrality = std::min(file, N-1-file);
-	int front = s + turn*N; // sq in front of current
-	int rank = s/N;
-	if (turn == -1)
-	    rank = RANK_BLACK-rank;
-	if (sq[front] == 0) {
-	    // front square empty, add it
-	    moves[num_moves].from = s;
-	    moves[num_moves].to = front;
-	    moves[num_moves].value = rank+file_centrality;
-	    if (rank+1 > best_unstoppable_rank && is_unstoppable(moves[num_moves].to)) {
-		best_unstoppable = num_moves;
-		best_unstoppable_rank = rank+1;
-	    }
-	    moves[num_moves++].replacing = 0;
-	    if (N >= 5 && rank == 0) {
-		// move ahead 2 squares?
-		int front2 = front + turn*N;
-		assert(front2 >= 0);
-		assert(front2 < NUM_ISQ);
-		if (sq[front2] == 0) {
-		    moves[num_moves].from = s;
-		    moves[num_moves].to = front2;
-		    moves[num_moves].value = rank+2+file_centrality;
-		    if (rank+2 > best_unstoppable_rank && is_unstoppable(moves[num_moves].to)) {
-			best_unstoppable = num_moves;
-			best_unstoppable_rank = rank+2;
-		    }
-		    // if there's something that can capture this, mark file as en passant
-		    if ((file != 0 && sq[front2-1] == -turn) ||
-			(file != N-1 && sq[front2+1] == -turn))
-			moves[num_moves].new_ep_file = file;
-		    moves[num_moves++].replacing = 0;
-		}
-	    }
-	}
-	if (file != 0 && sq[front-1] == -turn) {
-	    // may capture to left
-	    moves[num_moves].from = s;
-	    moves[num_moves].to = front-1;
-	    moves[num_moves].value = rank+file_centrality;
-	    moves[num_moves].value += (NUM_RANKS-rank)*(NUM_RANKS-rank) + 1;
-	    if (rank+1 > best_unstoppable_rank && is_unstoppable(moves[num_moves].to)) {
-		best_unstoppable = num_moves;
-		best_unstoppable_rank = rank+1;
-	    }
-	    moves[num_moves++].replacing = -turn;
-	}
-	if (file != N-1 && sq[front+1] == -turn) {
-	    // may capture to right
-	    moves[num_moves].from = s;
-	    moves[num_moves].to = front+1;
-	    moves[num_moves].value = rank+file_centrality;
-	    moves[num_moves].value += (NUM_RANKS-rank)*(NUM_RANKS-rank) + 1;
-	    if (rank+1 > best_unstoppable_rank && is_unstoppable(moves[num_moves].to)) {
-		best_unstoppable = num_moves;
-		best_unstoppable_rank = rank+1;
-	    }
-	    moves[num_moves++].replacing = -turn;
-	}
-	if ((turn == 1 && rank == EP_RANK_BLACK) || (turn == -1 && rank == EP_RANK_WHITE)) {
-	    if (file != 0 && ep_file == file-1) {
-		// may capture en passant to left
-		assert(sq[s-1] == -turn);
-		assert(sq[front-1] == 0);
-		moves[num_moves].from = s;
-		moves[num_moves].to = front-1;
-		moves[num_moves].value = rank+file_centrality;
-		moves[num_moves].value += (NUM_RANKS-rank+1)*(NUM_RANKS-rank+1)+1;
-		if (rank+1 > best_unstoppable_rank && is_unstoppable(moves[num_moves].to)) {
-		    best_unstoppable = num_moves;
-		    best_unstoppable_rank = rank+1;
-		}
-		assert(sq[moves[num_moves].to] == 0);
-		moves[num_moves].ep_square = s-1;
-		moves[num_moves++].replacing = 0;
-	    }
-	    if (file != N-1 && ep_file == file+1) {
-		// may capture en passant to right
-		assert(sq[s+1] == -turn);
-		assert(sq[front+1] == 0);
-		moves[num_moves].from = s;
-		moves[num_moves].to = front+1;
-		moves[num_moves].value = rank+file_centrality;
-		moves[num_moves].value += (NUM_RANKS-rank+1)*(NUM_RANKS-rank+1)+1;
-		if (rank+1 > best_unstoppable_rank && is_unstoppable(moves[num_moves].to)) {
-		    best_unstoppable = num_moves;
-		    best_unstoppable_rank = rank+1;
-		}
-		moves[num_moves].ep_square = s+1;
-		moves[num_moves++].replacing = 0;
-	    }
-	}
-    }
-
-    assert(num_moves <= MAX_LEGAL_MOVES);
-
-    if (best_unstoppable != -1)
-	moves[best_unstoppable].value += 100*(2+best_unstoppable_rank);
-
-    for (Move &m : moves)
-	m.old_ep_file = ep_file;
-
-    for (int i=0; i<num_moves-1; i++)
-    	for (int j=i+1; j<num_moves; j++) {
-	    //assert(moves[i].value != 999);
-	    //assert(moves[j].value != 999);
-    	    if (moves[j].value > moves[i].value) {
-    		Move tmp = moves[i];
-    		moves[i] = moves[j];
-    		moves[j] = tmp;
-    	    }
-    	}
-
-    return num_moves;
-}
-
-int Pos::winner() const {
-    int base;
-
-    assert(num_white >= 0 && num_black >= 0);
-
-    if (num_white == 0) {
-	assert(num_black > 0);
-	return -1; /* *canonized_player_flip;*/
-    } else if (num_black == 0)
-	return 1; /* canonized_player_flip; */
-
-    if (turn == 1)
-	base = SQ(0, NUM_RANKS-1);
-    else {
-	assert(turn == -1);
-	base = SQ(0, 0);
-    }
-    for (int i=0; i<N; i++)
-	if (sq[base+i] == turn)
-	    return turn; /**canonized_player_flip;*/
-    return 0;
-}
-
-bool Pos::operator==(const Pos &a) const {
-    if (turn != a.turn)
-	return false;
-
-    for (int i=0; i<NUM_ISQ; i++)
-	if (sq[i] != a.sq[i])
-	    return false;
-
-    if (ep_file != a.ep_file)
-	return false;
-
-    return true;
-}
-
-void Pos::force_count_pieces() const {
-    num_white = num_black = 0;
-    for (int i=0; i<NUM_ISQ; i++)
-	if (sq[i] == -1)
-	    num_black++;
-	else if (sq[i] == 1)
-	    num_white++;
-	else
-	    assert(sq[i] == 0);
-
-    if (num_white > N) {
-	cerr << "White has " << num_white << " pawns (>N)!" << endl;
-	this->print(cerr);
-	abort();
-    }
-    else if (num_black > N) {
-	cerr << "Black has" << num_black << " pawns (>N)!" << endl;
-	this->print(cerr);
-	abort();
-    }
-}
-
-Pos::Pos()
-    : turn(1)
-    , canonized_player_flip(1)
-    , horiz_flipped(false)
-    , ep_file(-1)
-{
-    for (int i=0; i<NUM_ISQ; i++)
-	sq[i] = 0;
-
-    for (int i=0; i<N; i++) {
-	sq[SQ(i, RANK_WHITE)] = 1;
-	sq[SQ(i, RANK_BLACK)] = -1;
-    }
-
-    count_pieces();
-}
-
-pos_t Pos::pack() const {
-    count_pieces();
-    uint64_t base = ranks_tab.base(num_white, num_black);
-    array<array<int, NUM_ISQ>, 3> squares; // black, empty, white
-    array<int, 3> num_squares{{0}};
-
-    for (int i=0; i<NUM_ISQ; i++) {
-	//assert(sq[i] >= -1 && sq[i] <= 1);
-	squares[sq[i]+1][num_squares[sq[i]+1]++] = i;
-    }
-    int num_white = num_squares[2], num_black = num_squares[0];
-
-    uint64_t whites_rank = rank_combination(squares[2].data(), num_white);
-    uint64_t blacks_rank = rank_combination(squares[0].data(), num_black);
-
-    uint64_t offset = whites_rank;
-    offset = offset * binom(NUM_ISQ, num_black) + blacks_rank;
-    offset = offset * 2 + (turn == -1);
-    offset = offset * (N+1) + ep_file + 1;
-
-    bool error = false;
-
-    if (DEBUG) {
-	if (num_white != N || num_black != N) {
-	    uint64_t base_range = ranks_tab[ranks_tab.find(base)+1]-ranks_tab[ranks_tab.find(base)];
-	    if (offset >= base_range) {
-		cerr << "pack error: offset >= base_range." << endl;
-		error = true;
-	    }
-	}
-    }
-
-    if (ranks_tab.find(base + offset) != num_white*(N+1)+num_black-1) {
-	cerr << "pack error: wrong index" << endl;
-	error = true;
-    }
-
-    if (error) {
-	print(cerr);
-	cerr << "base = " << base << endl;
-	cerr << "offset = " << offset << endl;
-	cerr << "whites_rank = " << whites_rank << endl;
-	cerr << "blacks_rank = " << blacks_rank << endl;
-	cerr << "num_white*(N+1)+num_black = " << num_white*(N+1)+num_black << endl;
-	cerr << "ranks_tab.find(base) = " << ranks_tab.find(base) << endl;
-	cerr << "ranks_tab@base = " << ranks_tab[ranks_tab.find(base)] << endl;
-	cerr << "base_range = " << ranks_tab[ranks_tab.find(base)+1]-ranks_tab[ranks_tab.find(base)] << endl;
-	cerr << "ranks_tab.find(base + offset) = index " << ranks_tab.find(base+offset) << endl;
-	cerr << "ranks_tab.find(base + offset) = " << ranks_tab[ranks_tab.find(base+offset)] << endl;
-	abort();
-    }
-    return base + offset;
-}
-
-Pos::Pos(pos_t compact) {
-    clear();
-
-    uint64_t idx = ranks_tab.find(compact);
-    assert(ranks_tab[idx] <= compact);
-    uint64_t base = ranks_tab[idx];
-    uint64_t offset = compact-base;
-
-    num_black = (idx+1)%(N+1);
-    num_white = (idx+1)/(N+1);
-
-    ep_file = (offset % (N+1)) - 1;
-    offset /= N+1;
-
-    if (offset % 2)
-	turn = -1;
-    else
-	turn = 1;
-    offset /= 2;
-
-    uint64_t b = binom(NUM_ISQ, num_black);
-    uint64_t blacks_rank = offset%b;
-    uint64_t whites_rank = offset/b;
-
-    array<int, N> squares;
-    unrank_combination(squares.data(), num_white, whites_rank);
-    for (int i=0; i<num_white; i++) {
-	assert(squares[i] >= 0);
-	assert(squares[i] < NUM_ISQ);
-	sq[squares[i]] = 1;
-    }
-
-    unrank_combination(squares.data(), num_black, blacks_rank);
-    for (int i=0; i<num_black; i++) {
-	assert(squares[i] >= 0);
-	assert(squares[i] < NUM_ISQ);
-	sq[squares[i]] = -1;
-    }
-
-}
-
-
-// mainly check that no player has more than N pawns
-void Pos::check_sanity() {
-    assert(turn == -1 || turn == 1);
-    assert(num_white >= 0 && num_black >= 0);
-
-    int s = 0;
-    for (int i=0; i<NUM_ISQ; i++) {
-	if (sq[i] == 1)
-	    s += i/N;
-	else if (sq[i] == -1)
-	    s += (NUM_RANKS-1-i/N);
-    }
-}
-
-ostream &Pos::print(ostream &str) const {
-    array<char, N*2+2> delim;
-
-    for (int i=0; i<N; i++) {
-	delim[i*2] = '+';
-	delim[i*2+1] = '-';
-    }
-    delim[N*2] = '+';
-    delim[N*2+1] = 0;
-
-    for (int y=N-1; y >= 0; y--) {
-	str << delim.data() << "\n";
-	str << "|";
-	for (int x=0; x < N; x++) {
-	    if (y == 0 || y == N-1)
-		str << " ";
-	    else if (y > 0 && y < N-1) {
-		int t = sq[SQ(x, y-1)];
-		assert(t == 0 || t == -1 || t == 1);
-		str << "o x"[t+1];
-	    }
-	    str << "|";
-	}
-	if (y == 0)
-	    str << "   " << player_name(turn) << " to move";
-	str << "\n";
-    }
-    str << delim.data() << "\n";
-    return str;
-}
-
-void Pos::clear() {
-    for (int i=0; i<NUM_ISQ; i++)
-	sq[i] = 0;
-    num_white = num_black = 0;
-}
-
-void Pos::random_position() {
-    int w = 0, b = 0;
-    do {
-	int r = rand();
-	w = r % N;
-	r /= N;
-	b = r%N;
-    } while (w == 0 && b == 0);
-    random_position(w, b);
-}
-
-void Pos::random_position(int nw, int nb) {
-    assert(nw >= 0 && nw <= N);
-    assert(nb >= 0 && nb <= N);
-    assert(nw != 0 || nb != 0);
-    clear();
-    num_white = nw;
-    num_black = nb;
-    while (nw) {
-	int x = rand()%NUM_ISQ;
-	if (sq[x] == 0) {
-	    sq[x] = 1;
-	    nw--;
-	}
-    }
-
-    while (nb) {
-	int x = rand()%NUM_ISQ;
-	if (sq[x] == 0) {
-	    sq[x] = -1;
-	    nb--;
-	}
-    }
-
-    if (rand() % 2)
-	turn = -1;
-    else
-	turn = 1;
-
-    // now check if any of the pawns not in turn could be just moved
-    // two spaces, and possibly mark one of them as en passant
-    const int prev_turn = -turn;
-    const bool prev_was_white = (turn == -1);
-    const int ep_rank = prev_was_white ? EP_RANK_WHITE : EP_RANK_BLACK;
-    const int first_ep_square = SQ(0, ep_rank);
-
-    ep_file = -1;
-
-    int ep_files[N], ep_count=0;
-    int ep_backward = turn*N;
-    for (int i=0; i<N; i++) {
-	if (sq[first_ep_square+i] == prev_turn) {
-	    if (((i != 0 && sq[first_ep_square+i-1] == turn) ||
-		 (i != N-1 && sq[first_ep_square+i+1] == turn)) &&
-		sq[first_ep_square+i+ep_backward] == 0 &&
-		sq[first_ep_square+i+2*ep_backward] == 0)
-		ep_files[ep_count++] = i; // something can take this
-	}
-    }
-
-    if (ep_count == 0)
-	return;
-
-    int ep = rand() % (ep_count + 1);
-    if (ep == ep_count)
-	ep_file = -1; // no en passant this time
-    else
-	ep_file = ep_files[ep];
-}
-
 void count_boards() {
     uint64_t total = 0;
     cout << "Possible " << N << "x" << N << " boards with a+b pawns:" << endl;
@@ -1007,8 +219,139 @@ void test_do_undo_move() {
     }
 }
 
-MemTranspositionTable<TP_TABLE_SIZE> tp_table;
-//CachedTranspositionTable<MemTranspositionTable<30146531>, MemTranspositionTable<TP_TABLE_SIZE> > tp_table;
+// Checks get_unmoves() against get_legal_moves() in both directions.
+void test_unmoves() {
+    int count = 0;
+    while (true) {
+	Pos p;
+	p.random_position();
+
+	// every move must be found as an unmove of the resulting position
+	array<Pos::Move, MAX_LEGAL_MOVES> moves;
+	int num_moves = p.get_legal_moves(moves);
+	for (int i=0; i<num_moves; i++) {
+	    Pos next(p);
+	    next.do_move(moves[i]);
+	    array<Pos::Move, MAX_UNMOVES> unmoves;
+	    int num_unmoves = next.get_unmoves(unmoves);
+	    bool found = false;
+	    for (int j=0; j<num_unmoves && !found; j++) {
+		Pos prev(next);
+		prev.undo_move(unmoves[j]);
+		found = prev == p;
+	    }
+	    if (!found) {
+		cout << "Move " << moves[i] << " not found as an unmove. Position before:" << endl;
+		p.print(cout);
+		abort();
+	    }
+	}
+
+	// every unmove must lead to a valid position with the move
+	array<Pos::Move, MAX_UNMOVES> unmoves;
+	int num_unmoves = p.get_unmoves(unmoves);
+	for (int i=0; i<num_unmoves; i++) {
+	    Pos prev(p);
+	    prev.undo_move(unmoves[i]);
+	    bool found = false;
+	    array<Pos::Move, MAX_LEGAL_MOVES> prev_moves;
+	    num_moves = prev.get_legal_moves(prev_moves);
+	    for (int j=0; j<num_moves && !found; j++) {
+		Pos next(prev);
+		next.do_move(prev_moves[j]);
+		found = next == p;
+	    }
+	    if (!found || !Pos(prev.pack()).is_valid()) {
+		cout << "Unmove " << unmoves[i] << " gives an invalid position:" << endl;
+		prev.print(cout);
+		abort();
+	    }
+	}
+	if (++count % 100000 == 0)
+	    cout << count << endl;
+    }
+}
+
+// Checks ClassEnumerator against unranking every index of the small
+// classes, split into randomly sized ranges.
+void test_class_enumerator() {
+    for (int nw=0; nw<=2; nw++)
+	for (int nb=0; nb<=2; nb++) {
+	    if (nw == 0 && nb == 0)
+		continue;
+	    const uint64_t size = ranks_tab.size(nw, nb);
+	    uint64_t begin = 0;
+	    while (begin < size) {
+		const uint64_t end = std::min(size, begin + 1 + rand()%1000);
+		ClassEnumerator e(nw, nb, begin, end);
+		for (uint64_t i=begin; i<end; i++, e.next()) {
+		    Pos p(ranks_tab.base(nw, nb) + i);
+		    if (e.done() || e.index() != ranks_tab.base(nw, nb) + i ||
+			!(e.pos() == p) || e.is_valid() != p.is_valid()) {
+			cout << "Enumerator mismatch in class " << nw << "+" << nb
+			     << " at offset " << i << endl;
+			abort();
+		    }
+		}
+		assert(e.done());
+		begin = end;
+	    }
+	    cout << nw << "+" << nb << ": " << size << " indices ok" << endl;
+	}
+}
+
+// Checks that TightIndex gives every position of the small classes an
+// index below the class size, the same for its mirror image, and that
+// position() inverts it. For even N, every index must be used.
+void test_tight_index() {
+    for (int nw=0; nw<=3; nw++)
+	for (int nb=0; nb<=3; nb++) {
+	    if (nw == 0 && nb == 0)
+		continue;
+	    const uint64_t size = tight_index.size(nw, nb);
+	    vector<bool> used(size);
+	    uint64_t num_used = 0;
+	    for (ClassEnumerator e(nw, nb); !e.done(); e.next()) {
+		if (!e.is_valid() || e.pos().get_turn() != 1)
+		    continue;
+		Pos mirrored(e.pos());
+		mirrored.horiz_mirror_board();
+		const uint64_t idx = tight_index.index(e.pos());
+		if (idx >= size || tight_index.index(mirrored) != idx ||
+		    tight_index.index(tight_index.position(nw, nb, idx)) != idx) {
+		    cout << "Bad tight index " << idx << " in class " << nw << "+" << nb
+			 << " for position:" << endl;
+		    e.pos().print(cout);
+		    abort();
+		}
+		if (!used[idx]) {
+		    used[idx] = true;
+		    num_used++;
+		}
+	    }
+	    if (N%2 == 0 && num_used != size) {
+		cout << "Class " << nw << "+" << nb << ": only " << num_used << " of "
+		     << size << " indices used" << endl;
+		abort();
+	    }
+	    cout << nw << "+" << nb << ": " << size << " indices (vs "
+		 << ranks_tab.size(nw, nb) << "), " << num_used << " used" << endl;
+	}
+}
+
+//MemTranspositionTable<TP_TABLE_SIZE> tp_table;
+#ifdef EXACT_TP_TABLE
+// Build with -DEXACT_TP_TABLE and run with --reachable to use an
+// exact table over the positions found by reachgen.
+CachedTranspositionTable<LocalTranspositionTable<L1_TABLE_SIZE>,
+			 ReachableTranspositionTable> tp_table(L1_PROMOTE_MIN_NODES);
+#else
+CachedTranspositionTable<LocalTranspositionTable<L1_TABLE_SIZE>,
+			 HybridTranspositionTable<DENSE_MAX_CLASS_SIZE,
+						  MemTranspositionTable<TP_TABLE_SIZE> > >
+    tp_table(L1_PROMOTE_MIN_NODES);
+#endif
+static std::unique_ptr<BestMoveTable<BEST_MOVE_TABLE_SIZE> > best_moves; // --best-moves
 
 // static void save_table() {
 //     stringstream fname;
@@ -1051,11 +394,21 @@ struct DepthInfo {
 
 typedef array<DepthInfo, VERBOSE_DEPTH> DepthInfoArray;
 
-static atomic<uint64_t> node_count{0};
-//static uint64_t node_count{0};
+static SearchCounters search_counters;
+#ifdef TREE_STATS
+static TreeStats tree_stats;
+static inline void tree_stats_bump(int depth, int counter, uint64_t delta = 1) {
+    tree_stats.local().bump(depth, counter, delta);
+}
+#else
+static inline void tree_stats_bump(int, int, uint64_t = 1) {}
+#endif
+static MoveOrdering move_ordering;
+static Tablebases tablebases;
 
+// researched = the table had a bound for packed that did not decide it
 static int negamax(Pos &p, int depth, int alpha, int beta, pos_t packed,
-		   DepthInfoArray &depth_info);
+		   bool researched, DepthInfoArray &depth_info);
 
 static int try_move(Pos &p, const Pos::Move &move, int depth, int alpha, int beta,
 		    DepthInfoArray &depth_info) {
@@ -1068,22 +421,38 @@ static int try_move(Pos &p, const Pos::Move &move, int depth, int alpha, int bet
     p.do_move(move);
 
     Pos canonized(p);
-    // cerr << "Before canonize:" << endl;
-    // canonized.print(cerr);
-    canonized.canonize();
-    assert(canonized.get_turn() == -turn);
-    // cerr << "After canonize:" << endl;
-    // canonized.print(cerr);
-    // cerr << "------------------------------------------------------------" << endl;
-
     pos_t packed = 0;
     bool got_result = false;
     int result = 0;
 
-    packed = canonized.pack();
-    //assert(packed%2 == 0);
-    //packed /= 2;
-    TpResult tpResult = tp_table.probe(packed);
+    {
+	PerfPhase phase(PERF_CANONIZE_PACK);
+	// cerr << "Before canonize:" << endl;
+	// canonized.print(cerr);
+	canonized.canonize();
+	assert(canonized.get_turn() == -turn);
+	// cerr << "After canonize:" << endl;
+	// canonized.print(cerr);
+	// cerr << "------------------------------------------------------------" << endl;
+
+	packed = canonized.pack();
+	//assert(packed%2 == 0);
+	//packed /= 2;
+    }
+    SearchCounters::Slot &counters = search_counters.local();
+    TpResult tpResult;
+    {
+	PerfPhase phase(PERF_TP_PROBE);
+	// exact results for small material; these never go to tp_table
+	tpResult = tablebases.probe(canonized);
+	if (tpResult != TpResult::NONE) {
+	    counters.bump(counters.tb_hits);
+	    tree_stats_bump(depth+1, TreeStats::TB_HITS);
+	} else {
+	    tpResult = tp_table.probe(packed);
+	    tree_stats_bump(depth+1, TreeStats::TP_RESULT + static_cast<int>(tpResult));
+	}
+    }
     // if (turn == -1)
     //tpResult = flip_result(tpResult);
 
@@ -1124,8 +493,8 @@ static int try_move(Pos &p, const Pos::Move &move, int depth, int alpha, int bet
     //p->check_sanity();
 
     if (!got_result) {
-	//uint64_t saved_node_count = node_count;
-	result = negamax(canonized, depth+1, -beta, -alpha, packed, depth_info);
+	result = negamax(canonized, depth+1, -beta, -alpha, packed,
+			 tpResult != TpResult::NONE, depth_info);
     }
 
     //cout << "Undoing move " << move << endl;
@@ -1141,9 +510,54 @@ static int try_move_copy(Pos p, const Pos::Move &move, int depth, int alpha, int
     return try_move(p, move, depth, alpha, beta, depth_info);
 }
 
-static void report_depthinfo(int depth, const DepthInfoArray &depth_info, int alpha,
-			     int beta, int result) {
-    const double size = tp_table.size()/double(TP_TABLE_SIZE)*100.0;
+// Fixed-size record of a search result at depth <= VERBOSE_DEPTH.
+// Search threads push these to progress_log and the ProgressLog thread
+// formats them, so that the search never waits for output.
+struct ProgressRecord {
+    uint64_t seq; // set by ProgressLog
+    uint32_t elapsed;
+    int8_t depth, turn, alpha, beta, result;
+    struct Step {
+	int8_t curr_move_num, num_moves, alpha, beta;
+	int8_t from, to, capture;
+    } path[VERBOSE_DEPTH];
+};
+
+static ProgressLog<ProgressRecord> progress_log;
+static std::ofstream progress_json;
+
+static void log_depthinfo(int depth, int turn, const DepthInfoArray &depth_info, int alpha,
+			  int beta, int result) {
+    ProgressRecord r;
+    r.elapsed = timer.elapsed();
+    r.depth = depth;
+    r.turn = turn;
+    r.alpha = alpha;
+    r.beta = beta;
+    r.result = result;
+    for (int j=0; j<depth; j++) {
+	r.path[j].curr_move_num = depth_info[j].curr_move_num;
+	r.path[j].num_moves = depth_info[j].num_moves;
+	r.path[j].alpha = depth_info[j].alpha;
+	r.path[j].beta = depth_info[j].beta;
+	r.path[j].from = depth_info[j].move.from;
+	r.path[j].to = depth_info[j].move.to;
+	r.path[j].capture = depth_info[j].move.replacing != 0;
+    }
+    progress_log.push(r);
+}
+
+static void print_move(ostream &os, const ProgressRecord::Step &step) {
+    os << sqname(step.from);
+    if (step.capture)
+	os << "x";
+    os << sqname(step.to);
+}
+
+// caller must hold cout_mutex
+static void report_depthinfo(const ProgressRecord &r, double size) {
+    const int depth = r.depth;
+    int alpha = r.alpha, beta = r.beta, result = r.result;
     const bool white_to_move = (depth%2 == 1);
 
     if (!white_to_move) {
@@ -1155,11 +569,11 @@ static void report_depthinfo(int depth, const DepthInfoArray &depth_info, int al
 
     {
 	//lock_guard<mutex> guard(cout_mutex);
-	cout << timer << "\t";
+	cout << "[" << r.elapsed << "]\t";
 	for (int j=0; j<depth; j++) {
-	    cout << depth_info[j].curr_move_num << "/"
-		 << depth_info[j].num_moves;
-	    int alpha = depth_info[j].alpha, beta = depth_info[j].beta;
+	    cout << int(r.path[j].curr_move_num) << "/"
+		 << int(r.path[j].num_moves);
+	    int alpha = r.path[j].alpha, beta = r.path[j].beta;
 	    assert(alpha >= -1);
 	    assert(alpha <= 1);
 	    assert(beta >= -1);
@@ -1187,7 +601,7 @@ static void report_depthinfo(int depth, const DepthInfoArray &depth_info, int al
 	for (int j=0; j<depth; j++) {
 	    if (j%2 == 0)
 		cout << j/2+1 << ". ";
-	    cout << depth_info[j].move;
+	    print_move(cout, r.path[j]);
 	    cout << " ";
 	}
 
@@ -1215,11 +629,83 @@ static void report_depthinfo(int depth, const DepthInfoArray &depth_info, int al
     }
 }
 
+// One JSON object per line; values are from the side to move at each depth.
+static void report_depthinfo_json(ostream &os, const ProgressRecord &r, double size) {
+    os << "{\"seq\":" << r.seq << ",\"elapsed\":" << r.elapsed
+       << ",\"depth\":" << int(r.depth) << ",\"path\":[";
+    for (int j=0; j<r.depth; j++) {
+	if (j)
+	    os << ",";
+	os << "{\"move\":\"";
+	print_move(os, r.path[j]);
+	os << "\",\"num\":" << int(r.path[j].curr_move_num)
+	   << ",\"of\":" << int(r.path[j].num_moves)
+	   << ",\"alpha\":" << int(r.path[j].alpha)
+	   << ",\"beta\":" << int(r.path[j].beta) << "}";
+    }
+    os << "],\"alpha\":" << int(r.alpha) << ",\"beta\":" << int(r.beta)
+       << ",\"result\":" << int(r.result) << ",\"tp_full\":" << size << "}\n";
+}
+
+// caller must hold cout_mutex
+static void report_tp_stats() {
+    auto lst = tp_table.level_stats();
+    const double probes = std::max<uint64_t>(lst.probes, 1);
+    cout << timer << "\tTransposition table: " << lst.probes << " probes, "
+	 << lst.l1_hits/probes*100.0 << "% L1 hits, "
+	 << lst.l2_hits/probes*100.0 << "% L2 hits; "
+	 << lst.l1_stores << " L1 stores, " << lst.l2_stores << " promoted to L2" << endl;
+
+    static const char *result_names[NUM_TP_RESULTS] = {
+	nullptr, "loss", "draw", "win", ">=0", "<=0"};
+    TpTableStats st = tp_table.stats();
+    cout << timer << "\tShared table: " << st.occupied << " occupied ("
+	 << st.occupied/double(tp_table.get_capacity())*100.0 << "%:";
+    for (int i=1; i<NUM_TP_RESULTS; i++)
+	cout << " " << result_names[i] << "=" << st.by_result[i];
+    cout << "), " << st.collisions << " collisions, " << st.overwrites << " overwrites, "
+	 << st.merges << " merges in " << st.stores << " stores" << endl;
+
+#ifndef EXACT_TP_TABLE
+    const auto &hybrid = tp_table.shared();
+    const TpTableStats dense = hybrid.dense_stats(), hashed = hybrid.hashed_stats();
+    cout << timer << "\tDense region: " << hybrid.get_num_dense_classes() << " classes, "
+	 << hybrid.dense_bytes() << " bytes, " << dense.occupied << " of "
+	 << hybrid.get_dense_capacity() << " slots occupied, " << dense.hits << " hits; hashed: "
+	 << hybrid.hashed_bytes() << " bytes, " << hashed.occupied
+	 << " of " << hybrid.get_hashed_capacity() << " slots occupied, " << hashed.hits
+	 << " hits" << endl;
+#endif
+}
+
+static void write_progress(const vector<ProgressRecord> &records) {
+    const double size = tp_table.size()/double(tp_table.get_capacity())*100.0;
+    lock_guard<mutex> guard(cout_mutex);
+    for (const ProgressRecord &r : records) {
+	report_depthinfo(r, size);
+	if (progress_json.is_open())
+	    report_depthinfo_json(progress_json, r, size);
+
+	if (r.depth == 1) {
+	    cout << "[" << r.elapsed << "]\tDepth " << int(r.depth) << ": move "
+		 << int(r.path[0].curr_move_num) << "/" << int(r.path[0].num_moves)
+		 << " RESULT=" << r.result*r.turn << endl;
+	    size_t a = tp_table.size();
+	    cout << timer << "\tTransposition table size = " << a << " ("
+		 << a/double(tp_table.get_capacity())*100.0 << "% full)" << endl;
+	    report_tp_stats();
+	}
+    }
+    if (progress_json.is_open())
+	progress_json.flush();
+}
+
 static atomic<bool> abortRequested{false};
 static bool threads_running = false;
 static mutex threads_free_mutex;
 static condition_variable threads_free_cond;
-static int threads_free_count = NUM_THREADS;
+static int num_threads = DEFAULT_THREADS;
+static int threads_free_count; // set from num_threads in main()
 
 class ThreadFreer {
     bool parallelize;
@@ -1237,7 +723,7 @@ public:
 };
 
 static int negamax(Pos &p, int depth, int alpha, int beta, pos_t packed,
-		   DepthInfoArray &depth_info) {
+		   bool researched, DepthInfoArray &depth_info) {
     if (DEBUG_POSITION != 0 && packed == DEBUG_POSITION) {
 	cout << "negamax: start " << packed << ", ab=" << alpha << "," << beta << endl;
 	p.print(cout);
@@ -1247,35 +733,58 @@ static int negamax(Pos &p, int depth, int alpha, int beta, pos_t packed,
 	assert(threads_running);
 	return RESULT_ABORTED;
     }
-    node_count.fetch_add(1, std::memory_order_relaxed);
+    SearchCounters::Slot &counters = search_counters.local();
+    const uint64_t node_count_orig = counters.nodes.load(std::memory_order_relaxed);
+    counters.bump(counters.nodes);
 
     array<Pos::Move, MAX_LEGAL_MOVES> moves;
     //array<int, MAX_LEGAL_MOVES> results;
 
     const int turn = p.get_turn();
-    int num_legal_moves = p.get_legal_moves(moves);
-
-    //p->print(cout);
+    int num_legal_moves;
+    MoveOrdering::Keys move_keys;
+    {
+	PerfPhase phase(PERF_MOVEGEN);
+	num_legal_moves = p.get_legal_moves(moves);
+
+	//p->print(cout);
+
+	tree_stats_bump(depth, TreeStats::NODES);
+	tree_stats_bump(depth, TreeStats::MOVES, num_legal_moves);
+	if (num_legal_moves != 0 && p.is_horiz_symmetric()) {
+	    int p = 0;
+	    for (int i=0; i<num_legal_moves; i++)
+		if (!moves[i].is_from_right_half())
+		    moves[p++] = moves[i];
+	    num_legal_moves = p;
+	}
+	tree_stats_bump(depth, TreeStats::MOVES_AFTER_SYMMETRY, num_legal_moves);
+	move_ordering.score(p, depth, moves, num_legal_moves, move_keys);
+	// Only positions searched before can have a best move, and the
+	// extra cache miss is not worth it for the others.
+	if (best_moves && researched) {
+	    const int code = best_moves->probe(packed);
+	    for (int i=0; i<num_legal_moves && code != 0; i++)
+		if (best_moves->move_code(moves[i]) == code) {
+		    MoveOrdering::try_first(move_keys, i);
+		    counters.bump(counters.best_move_hits);
+		    break;
+		}
+	}
+    }
 
     if (num_legal_moves == 0) {
 	//cout << "Game over." << endl;
+	tree_stats_bump(depth, TreeStats::TERMINAL + 1 + p.winner());
 	return p.winner();
     }
 
-    const bool is_horiz_symm = p.is_horiz_symmetric();
-    if (is_horiz_symm) {
-	int p = 0;
-	for (int i=0; i<num_legal_moves; i++)
-	    if (!moves[i].is_from_right_half())
-		moves[p++] = moves[i];
-	num_legal_moves = p;
-    }
-
     if (depth <= VERBOSE_DEPTH)
 	depth_info[depth-1].num_moves = num_legal_moves;
 
     const int alpha_orig = alpha;
     int best_value = -1;
+    int best_move = 0;
 
     bool parallelize_rest = !threads_running && depth <= PARALLEL_DEPTH &&
 	depth >= PARALLEL_MIN_DEPTH;
@@ -1296,9 +805,15 @@ static int negamax(Pos &p, int depth, int alpha, int beta, pos_t packed,
 	    depth_info[depth-1].beta = beta;
 	}
 
-	if (parallelize)
+	if (parallelize) {
+	    // the whole subtree is searched by this thread
+	    SearchCounters::Slot &counters = search_counters.local();
+	    const uint64_t nodes_before = counters.nodes.load(std::memory_order_relaxed);
 	    result = try_move_copy(p, moves[i], depth, alpha, beta, depth_info);
-	else
+	    if (result == RESULT_ABORTED)
+		counters.bump(counters.aborted_nodes,
+			      counters.nodes.load(std::memory_order_relaxed) - nodes_before);
+	} else
 	    result = try_move(p, moves[i], depth, alpha, beta, depth_info);
 	results[i] = result;
 
@@ -1308,28 +823,18 @@ static int negamax(Pos &p, int depth, int alpha, int beta, pos_t packed,
 	}
 
 	if (depth <= VERBOSE_DEPTH) {
-	    {
-		lock_guard<mutex> guard(cout_mutex);
-		//cout << "depth " << depth << ": result=" << result*turn << endl;
-		report_depthinfo(depth, depth_info, alpha, beta, result);
-	    }
-
-	    if (depth == 1) {
-		lock_guard<mutex> guard(cout_mutex);
-		cout << timer << "\tDepth " << depth << ": move "
-		     << i+1 << "/" << num_legal_moves << " RESULT=" << result*turn << endl;
-		//canonized.print(cout);
-		size_t a = tp_table.size();
-		cout << timer << "\tTransposition table size = " << a << " ("
-		     << a/double(TP_TABLE_SIZE)*100.0 << "% full)" << endl;
-	    }
+	    //cout << "depth " << depth << ": result=" << result*turn << endl;
+	    log_depthinfo(depth, turn, depth_info, alpha, beta, result);
 	}
 
 	if (parallelize && depth >= CUT_MIN_DEPTH) {
 	    // See if we can cut off
 	    int new_alpha = std::max(result, alpha);
-	    if (new_alpha >= beta)
+	    if (new_alpha >= beta) {
 		abortRequested.store(true, std::memory_order_relaxed);
+		move_ordering.cutoff(p, depth, moves[i]);
+		tree_stats_bump(depth, TreeStats::CUTOFF_AT + i);
+	    }
 	}
     };
 
@@ -1337,17 +842,24 @@ static int negamax(Pos &p, int depth, int alpha, int beta, pos_t packed,
     if (!parallelize) {
 	for (int i=0; i<num_legal_moves; i++) {
 	    assert(alpha < beta);
+	    MoveOrdering::select(moves, move_keys, i, num_legal_moves);
 	    search_move(i, depth_info);
 	    if (DEBUG_POSITION != 0 && packed == DEBUG_POSITION) {
 		cout << "Move " << i << ": result=" << results[i] << endl;
 	    }
 	    if (results[i] == RESULT_ABORTED)
 		return RESULT_ABORTED;
-	    best_value = std::max(results[i], best_value);
+	    if (results[i] > best_value) {
+		best_value = results[i];
+		best_move = i;
+	    }
 	    if (depth >= CUT_MIN_DEPTH)
 		alpha = std::max(results[i], alpha);
-	    if (alpha >= beta)
+	    if (alpha >= beta) {
+		move_ordering.cutoff(p, depth, moves[i]);
+		tree_stats_bump(depth, TreeStats::CUTOFF_AT + i);
 		break; /* alpha cutoff */
+	    }
 	    if (parallelize_rest && alpha + beta != 0) {
 		next_move = i+1;
 		parallelize = true;
@@ -1367,25 +879,37 @@ static int negamax(Pos &p, int depth, int alpha, int beta, pos_t packed,
 	threads_running = true;
 	assert(alpha < beta);
 	for (int i=next_move; i<num_legal_moves; i++) {
+	    MoveOrdering::select(moves, move_keys, i, num_legal_moves);
 	    {
 		results[i] = RESULT_ABORTED;
 		unique_lock<mutex> guard(threads_free_mutex);
-		while (threads_free_count == 0)
-		    threads_free_cond.wait(guard);
+		if (threads_free_count == 0) {
+		    PerfPhase phase(PERF_THREAD_WAIT);
+		    const auto wait_start = std::chrono::steady_clock::now();
+		    while (threads_free_count == 0)
+			threads_free_cond.wait(guard);
+		    counters.bump(counters.wait_ns, std::chrono::duration_cast<std::chrono::nanoseconds>(
+				      std::chrono::steady_clock::now() - wait_start).count());
+		}
 		--threads_free_count;
 	    }
 	    threads.emplace_back(search_move, i, std::ref(depth_infos[i]));
 	}
 
-	for (auto &t : threads)
-	    t.join();
+	{
+	    PerfPhase phase(PERF_THREAD_WAIT);
+	    for (auto &t : threads)
+		t.join();
+	}
 	threads_running = false;
 
 	abortRequested.store(false, std::memory_order_relaxed);
 
 	for (int i=0; i<num_legal_moves; i++)
-	    if (results[i] != RESULT_ABORTED)
-		best_value = std::max(best_value, results[i]);
+	    if (results[i] != RESULT_ABORTED && results[i] > best_value) {
+		best_value = results[i];
+		best_move = i;
+	    }
     }
 
     // if (alpha >= beta)
@@ -1420,14 +944,267 @@ static int negamax(Pos &p, int depth, int alpha, int beta, pos_t packed,
 	}
 	// if (turn == -1)
 	//     tp_res = flip_result(tp_res);
-	tp_table.add(packed, tp_res);
+
+	// Subtrees searched by other threads are not counted, so always
+	// promote parallelized nodes to the shared table.
+	uint64_t subtree_nodes = counters.nodes.load(std::memory_order_relaxed) - node_count_orig;
+	if (parallelize)
+	    subtree_nodes = UINT64_MAX;
+	PerfPhase phase(PERF_TP_STORE);
+	tp_table.add(packed, tp_res, subtree_nodes);
+	// if no move raised alpha, none of them is known to be better
+	if (best_moves && best_value > alpha_orig && subtree_nodes >= BEST_MOVE_MIN_NODES)
+	    best_moves->add(packed, moves[best_move]);
     }
     assert(best_value >= -1);
     assert(best_value <= 1);
     return best_value;
 }
 
-int main() {
+// Prints node and probe rates every REPORT_INTERVAL seconds, overall
+// and per thread slot, from a background thread.
+class ThroughputReporter {
+    typedef std::chrono::steady_clock clock;
+    mutex stop_mutex;
+    condition_variable stop_cond;
+    bool stop_requested = false;
+    thread reporter;
+
+    typedef decltype(tp_table)::LevelStats LevelStats;
+
+    static void report(const char *label, const SearchCounters::Totals &t,
+		       const LevelStats &tp, double secs) {
+	cout << timer << "\t" << label << ": " << t.nodes << " nodes, "
+	     << t.nodes/secs << " nodes/s, " << tp.probes/secs << " probes/s, "
+	     << tp.hits()/std::max<double>(tp.probes, 1)*100.0 << "% hits, "
+	     << t.tb_hits << " tablebase hits" << endl;
+    }
+
+    void run() {
+	array<SearchCounters::Totals, MAX_THREAD_SLOTS> prev_slots;
+	array<LevelStats, MAX_THREAD_SLOTS> prev_slots_tp;
+	SearchCounters::Totals prev = search_counters.totals();
+	LevelStats prev_tp = tp_table.level_stats();
+	auto prev_time = clock::now();
+	unique_lock<mutex> guard(stop_mutex);
+	while (!stop_cond.wait_for(guard, std::chrono::seconds(REPORT_INTERVAL),
+				   [this] { return stop_requested; })) {
+	    auto now = clock::now();
+	    double secs = std::chrono::duration<double>(now - prev_time).count();
+	    SearchCounters::Totals total = search_counters.totals();
+	    LevelStats total_tp = tp_table.level_stats();
+
+	    lock_guard<mutex> cout_guard(cout_mutex);
+	    report("Throughput", total - prev, total_tp - prev_tp, secs);
+	    for (int i=0; i<thread_slots_used(); i++) {
+		SearchCounters::Totals t = search_counters.slot_totals(i);
+		if (t.nodes == prev_slots[i].nodes)
+		    continue;
+		LevelStats tp = tp_table.slot_level_stats(i);
+		stringstream label;
+		label << "  thread slot " << i;
+		report(label.str().c_str(), t - prev_slots[i], tp - prev_slots_tp[i], secs);
+		prev_slots[i] = t;
+		prev_slots_tp[i] = tp;
+	    }
+	    if (PERF_PERIODIC_REPORT)
+		perf_report(cout, false);
+	    prev = total;
+	    prev_tp = total_tp;
+	    prev_time = now;
+	}
+    }
+public:
+    void start() {
+	if (REPORT_INTERVAL > 0)
+	    reporter = thread(&ThroughputReporter::run, this);
+    }
+    void stop() {
+	{
+	    lock_guard<mutex> guard(stop_mutex);
+	    stop_requested = true;
+	}
+	stop_cond.notify_one();
+	if (reporter.joinable())
+	    reporter.join();
+    }
+};
+
+#ifdef TREE_STATS
+// Prints the tree statistics (-DTREE_STATS) whenever the process gets
+// SIGUSR1. The signal is blocked in every thread (block() must be
+// called before any are started) and taken with sigwait() by this one,
+// so that the search threads never run a signal handler.
+class TreeStatsReporter {
+    sigset_t signals;
+    atomic<bool> stop_requested{false};
+    thread reporter;
+
+    void run() {
+	int sig;
+	while (sigwait(&signals, &sig) == 0 && !stop_requested.load()) {
+	    lock_guard<mutex> cout_guard(cout_mutex);
+	    cout << timer << "\tSearch tree by depth so far:" << endl;
+	    tree_stats.report(cout);
+	}
+    }
+public:
+    TreeStatsReporter() {
+	sigemptyset(&signals);
+	sigaddset(&signals, SIGUSR1);
+    }
+    void block() {
+	pthread_sigmask(SIG_BLOCK, &signals, nullptr);
+    }
+    void start() {
+	reporter = thread(&TreeStatsReporter::run, this);
+    }
+    void stop() {
+	if (!reporter.joinable())
+	    return;
+	stop_requested.store(true);
+	pthread_kill(reporter.native_handle(), SIGUSR1);
+	reporter.join();
+    }
+};
+#else
+class TreeStatsReporter {
+public:
+    void block() {}
+    void start() {}
+    void stop() {}
+};
+#endif
+
+static void usage(const char *argv0) {
+    cerr << "Usage: " << argv0 << " [options]\n"
+	 << "  --progress-json FILE  also write progress records as JSON lines to FILE\n"
+	 << "  --tablebases DIR      probe the tablebases in DIR (made by tbgen)\n"
+	 << "  --tb-pawns K          use tablebases for positions with at most K pawns\n"
+	 << "                        (default " << DEFAULT_TB_PAWNS << ")\n"
+	 << "  --reachable FILE      exact table over the positions in FILE (made by\n"
+	 << "                        reachgen); needs a build with -DEXACT_TP_TABLE\n"
+	 << "  --position POS        solve POS (see Pos::parse()) instead of the initial\n"
+	 << "                        position; the result is for the side to move\n"
+	 << "  --bench-json FILE     write a JSON summary of the solve to FILE\n"
+	 << "  --threads K           search with at most K threads (default "
+	 << DEFAULT_THREADS << ")\n"
+	 << "  --static-ordering     order moves by Move::value only, without the\n"
+	 << "                        killer and history heuristics\n"
+	 << "  --best-moves          store the best move of each position searched\n"
+	 << "                        and try it first when the position is searched\n"
+	 << "                        again\n"
+	 << "  --prove WHAT          only prove or disprove a win (WHAT = win) or a\n"
+	 << "                        loss (loss) for the side to move with a null-\n"
+	 << "                        window search, or find the result by first\n"
+	 << "                        doing the one and then if needed the other (both)\n";
+}
+
+int main(int argc, char **argv) {
+    static const struct option long_options[] = {
+	{"progress-json", required_argument, nullptr, 'j'},
+	{"tablebases", required_argument, nullptr, 't'},
+	{"tb-pawns", required_argument, nullptr, 'k'},
+	{"reachable", required_argument, nullptr, 'r'},
+	{"position", required_argument, nullptr, 'p'},
+	{"bench-json", required_argument, nullptr, 'b'},
+	{"threads", required_argument, nullptr, 'n'},
+	{"static-ordering", no_argument, nullptr, 's'},
+	{"best-moves", no_argument, nullptr, 'm'},
+	{"prove", required_argument, nullptr, 'w'},
+	{"help", no_argument, nullptr, 'h'},
+	{nullptr, 0, nullptr, 0}
+    };
+    string tb_dir, reachable_file, position, bench_json, prove;
+    int tb_pawns = DEFAULT_TB_PAWNS;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "h", long_options, nullptr)) != -1) {
+	switch (opt) {
+	case 't':
+	    tb_dir = optarg;
+	    break;
+	case 'k':
+	    tb_pawns = atoi(optarg);
+	    break;
+	case 'r':
+	    reachable_file = optarg;
+	    break;
+	case 'p':
+	    position = optarg;
+	    break;
+	case 'b':
+	    bench_json = optarg;
+	    break;
+	case 's':
+	    move_ordering.dynamic = false;
+	    break;
+	case 'm':
+	    best_moves = std::make_unique<BestMoveTable<BEST_MOVE_TABLE_SIZE> >();
+	    break;
+	case 'w':
+	    prove = optarg;
+	    if (prove != "win" && prove != "loss" && prove != "both") {
+		cerr << "--prove must be win, loss or both" << endl;
+		return 1;
+	    }
+	    break;
+	case 'n':
+	    num_threads = atoi(optarg);
+	    // the main thread and the search threads each take a slot
+	    if (num_threads < 1 || num_threads >= MAX_THREAD_SLOTS) {
+		cerr << "--threads must be between 1 and " << MAX_THREAD_SLOTS-1 << endl;
+		return 1;
+	    }
+	    break;
+	case 'j':
+	    progress_json.open(optarg);
+	    if (!progress_json) {
+		cerr << "Could not open " << optarg << " for writing" << endl;
+		return 1;
+	    }
+	    break;
+	case 'h':
+	    usage(argv[0]);
+	    return 0;
+	default:
+	    usage(argv[0]);
+	    return 1;
+	}
+    }
+
+    threads_free_count = num_threads;
+    TreeStatsReporter tree_stats_reporter;
+    tree_stats_reporter.block();
+
+    if (!tb_dir.empty()) {
+	cout << timer << "\tLoading tablebases for up to " << tb_pawns << " pawns from "
+	     << tb_dir << "..." << endl;
+	tablebases.load(tb_dir, tb_pawns);
+    }
+
+#ifdef EXACT_TP_TABLE
+    if (reachable_file.empty()) {
+	cerr << "This build needs --reachable" << endl;
+	return 1;
+    }
+    cout << timer << "\tLoading reachable positions from " << reachable_file << "..." << endl;
+    ReachableTranspositionTable &exact = tp_table.shared();
+    exact.load_index(reachable_file);
+    cout << timer << "\tExact table: " << exact.get_capacity() << " positions, "
+	 << exact.index_bytes() << " bytes of index, " << exact.result_bytes()
+	 << " bytes of results" << endl;
+    if (!position.empty()) {
+	// the index only covers positions reachable from the initial one
+	cerr << "--position cannot be used with --reachable" << endl;
+	return 1;
+    }
+#else
+    if (!reachable_file.empty()) {
+	cerr << "--reachable needs a build with -DEXACT_TP_TABLE" << endl;
+	return 1;
+    }
+#endif
+
     //struct sigaction sa;
 
     // FIXME signals and threads don't mix
@@ -1439,12 +1216,23 @@ int main() {
     //count_boards();
     //test_pack_unpack();
     //test_do_undo_move();
+    //test_unmoves();
+    //test_class_enumerator();
+    //test_tight_index();
     //exit(0);
 
     //load_table();
 
     //map<pos_t, int> tp_table;
     Pos p;
+    if (!position.empty()) {
+	if (!p.parse(position)) {
+	    cerr << "Invalid position: " << position << endl;
+	    return 1;
+	}
+	p.canonize();
+	p = Pos(p.pack()); // forget the canonization
+    }
     // array<Pos::Move, MAX_LEGAL_MOVES> m;
     // p.get_legal_moves(m);
     // p.do_move(m[6]);
@@ -1452,8 +1240,95 @@ int main() {
 
     DepthInfoArray depth_info;
 
-    int result = negamax(p, 1, -1 /* alpha */, 1 /* beta */, 0 /* packed */,
-			 depth_info);
+    perf_init(cout);
+    auto start_time = std::chrono::steady_clock::now();
+    ThroughputReporter reporter;
+    reporter.start();
+    tree_stats_reporter.start();
+    progress_log.start(write_progress);
+
+    // With --prove, the null-window searches leave the same bounds
+    // (LOWER_BOUND_0, UPPER_BOUND_0) in the table as the full-window
+    // one, so the second one of "both" reuses what the first found.
+    auto search = [&](int alpha, int beta) {
+	const uint64_t nodes_before = search_counters.totals().nodes;
+	const int r = negamax(p, 1, alpha, beta, 0 /* packed */, false /* researched */,
+			      depth_info);
+	lock_guard<mutex> guard(cout_mutex);
+	cout << timer << "\tWindow (" << alpha << ", " << beta << "): "
+	     << search_counters.totals().nodes - nodes_before << " nodes, "
+	     << (r >= beta ? "fails high" : r <= alpha ? "fails low" : "exact") << endl;
+	return r;
+    };
+    int result;
+    const char *bound = "exact"; // or what result is: "upper" (<=), "lower" (>=)
+    if (prove.empty())
+	result = search(-1, 1);
+    else {
+	result = 0;
+	bool decided = false;
+	if (prove != "loss") {
+	    decided = search(0, 1) >= 1;
+	    if (decided)
+		result = 1;
+	    else
+		bound = "upper";
+	}
+	if (!decided && prove != "win") {
+	    if (search(-1, 0) <= -1)
+		result = -1;
+	    bound = result == -1 || prove == "both" ? "exact" : "lower";
+	}
+    }
 
-    cout << timer << "\tresult=" << result << endl;
+    progress_log.stop();
+    reporter.stop();
+    tree_stats_reporter.stop();
+    if (progress_log.num_dropped())
+	cout << timer << "\t" << progress_log.num_dropped()
+	     << " progress records dropped" << endl;
+    double secs = std::chrono::duration<double>(std::chrono::steady_clock::now()
+						- start_time).count();
+    SearchCounters::Totals total = search_counters.totals();
+    const auto total_tp = tp_table.level_stats();
+    const double tp_hit_rate = total_tp.hits()/std::max<double>(total_tp.probes, 1);
+    cout << timer << "\tSearched " << total.nodes << " nodes in " << secs << " s ("
+	 << total.nodes/secs << " nodes/s, " << tp_hit_rate*100.0 << "% probe hits, "
+	 << total.tb_hits << " tablebase hits)" << endl;
+    cout << timer << "\t" << num_threads << " threads: " << total.aborted_nodes
+	 << " nodes in aborted subtrees, " << total.wait_ns*1e-9
+	 << " s waiting for a free thread" << endl;
+    if (best_moves)
+	cout << timer << "\tBest move table: " << best_moves->capacity << " entries ("
+	     << best_moves->bytes << " bytes), first move in " << total.best_move_hits
+	     << " nodes" << endl;
+
+    cout << timer << "\tresult" << (bound[0] == 'u' ? "<=" : bound[0] == 'l' ? ">=" : "=")
+	 << result << endl;
+    report_tp_stats();
+    perf_report(cout, true);
+#ifdef TREE_STATS
+    cout << timer << "\tSearch tree by depth:" << endl;
+    tree_stats.report(cout);
+#endif
+
+    if (!bench_json.empty()) {
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	std::ofstream out(bench_json);
+	out << "{\"n\":" << N << ",\"position\":\"" << (position.empty() ? "initial" : position)
+	    << "\",\"threads\":" << num_threads << ",\"result\":" << result
+	    << ",\"bound\":\"" << bound << "\",\"prove\":\"" << (prove.empty() ? "full" : prove) << "\""
+	    << ",\"seconds\":" << secs << ",\"nodes\":" << total.nodes
+	    << ",\"nodes_per_sec\":" << total.nodes/secs
+	    << ",\"tp_hit_rate\":" << tp_hit_rate
+	    << ",\"tb_hits\":" << total.tb_hits << ",\"aborted_nodes\":" << total.aborted_nodes
+	    << ",\"wait_seconds\":" << total.wait_ns*1e-9
+	    << ",\"best_move_hits\":" << total.best_move_hits << ",\"peak_rss_kb\":" << usage.ru_maxrss
+	    << "}" << endl;
+	if (!out) {
+	    cerr << "Could not write " << bench_json << endl;
+	    return 1;
+	}
+    }
 }
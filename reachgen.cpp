@@ -0,0 +1,149 @@
+// Copyright (C) 2016  Sami Liedes
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+// Enumerates the positions reachable from the initial position, packed
+// after canonize() as the search sees them, and writes a
+// ReachableIndex of them for the exact transposition table (see
+// ReachableTranspositionTable.hpp). Every move increases
+// Pos::get_progress(), so the positions are found layer by layer as in
+// layersolve, but in memory: only for boards where the positions of
+// each class fit in memory at 8 bytes each.
+
+#include "Pos.hpp"
+#include "ReachableIndex.hpp"
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <cstdlib>
+#include <ctime>
+#include <getopt.h>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using std::array;
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::string;
+using std::thread;
+using std::vector;
+
+static int num_threads = std::thread::hardware_concurrency();
+
+// Calls f(begin, end) on num_threads contiguous parts of [0, n).
+template<class F>
+static void parallel_for(uint64_t n, F f) {
+    vector<thread> threads;
+    for (int i=0; i<num_threads; i++) {
+	uint64_t begin = n*i/num_threads, end = n*(i+1)/num_threads;
+	threads.emplace_back([f, begin, end] { f(begin, end); });
+    }
+    for (auto &t : threads)
+	t.join();
+}
+
+// Returns the reachable positions by class (Compact_tab index).
+static vector<vector<pos_t>> find_reachable() {
+    vector<vector<pos_t>> classes((N+1)*(N+1)-1);
+    vector<vector<pos_t>> layers(MAX_PROGRESS+1);
+    Pos initial;
+    layers[initial.get_progress()].push_back(initial.pack());
+
+    for (int k=0; k<=MAX_PROGRESS; k++) {
+	vector<pos_t> &layer = layers[k];
+	std::sort(layer.begin(), layer.end());
+	layer.erase(std::unique(layer.begin(), layer.end()), layer.end());
+	if (layer.empty())
+	    continue;
+	for (pos_t pos : layer)
+	    classes[ranks_tab.find(pos)].push_back(pos);
+
+	std::mutex layers_mutex;
+	parallel_for(layer.size(), [&](uint64_t begin, uint64_t end) {
+		array<vector<pos_t>, MAX_PROGRESS_STEP> children;
+		for (uint64_t i=begin; i<end; i++) {
+		    Pos p(layer[i]);
+		    array<Pos::Move, MAX_LEGAL_MOVES> moves;
+		    const int num_moves = p.get_legal_moves(moves);
+		    for (int j=0; j<num_moves; j++) {
+			p.do_move(moves[j]);
+			Pos child(p);
+			p.undo_move(moves[j]);
+			child.canonize();
+			const int step = child.get_progress() - k;
+			assert(step >= 1 && step <= MAX_PROGRESS_STEP);
+			children[step-1].push_back(child.pack());
+		    }
+		}
+		std::lock_guard<std::mutex> guard(layers_mutex);
+		for (int step=1; step<=MAX_PROGRESS_STEP; step++)
+		    layers[k+step].insert(layers[k+step].end(), children[step-1].begin(),
+					  children[step-1].end());
+	    });
+	cout << "[" << time(NULL) << "] layer " << k << ": " << layer.size() << " positions"
+	     << endl;
+	vector<pos_t>().swap(layer);
+    }
+    return classes;
+}
+
+static void usage(const char *argv0) {
+    cerr << "Usage: " << argv0 << " [options] OUTPUT\n"
+	 << "Writes an index of the positions reachable from the initial position.\n"
+	 << "  -j, --threads N     number of threads (default: number of CPUs)\n";
+}
+
+int main(int argc, char **argv) {
+    static const struct option long_options[] = {
+	{"threads", required_argument, nullptr, 'j'},
+	{"help", no_argument, nullptr, 'h'},
+	{nullptr, 0, nullptr, 0}
+    };
+    int opt;
+    while ((opt = getopt_long(argc, argv, "j:h", long_options, nullptr)) != -1) {
+	switch (opt) {
+	case 'j':
+	    num_threads = atoi(optarg);
+	    break;
+	case 'h':
+	    usage(argv[0]);
+	    return 0;
+	default:
+	    usage(argv[0]);
+	    return 1;
+	}
+    }
+    if (optind != argc-1 || num_threads < 1) {
+	usage(argv[0]);
+	return 1;
+    }
+
+    vector<vector<pos_t>> classes = find_reachable();
+    uint64_t total = 0;
+    for (const auto &c : classes)
+	total += c.size();
+    cout << "[" << time(NULL) << "] " << total << " reachable positions of "
+	 << ranks_tab[(N+1)*(N+1)-1] << " indices; building the index" << endl;
+
+    ReachableIndex index;
+    index.build(std::move(classes));
+    cout << "[" << time(NULL) << "] " << index.memory_bytes() << " bytes, "
+	 << index.memory_bytes()*8.0/std::max<uint64_t>(total, 1) << " bits per position" << endl;
+    index.write(argv[optind]);
+}
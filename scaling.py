@@ -0,0 +1,92 @@
+#!/usr/bin/env python3
+#
+# Copyright (C) 2016  Sami Liedes
+#
+# This program is free software; you can redistribute it and/or modify
+# it under the terms of the GNU General Public License as published by
+# the Free Software Foundation; either version 2 of the License, or
+# (at your option) any later version.
+#
+# This program is distributed in the hope that it will be useful,
+# but WITHOUT ANY WARRANTY; without even the implied warranty of
+# MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+# GNU General Public License for more details.
+#
+# You should have received a copy of the GNU General Public License along
+# with this program; if not, write to the Free Software Foundation, Inc.,
+# 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+# Solves one of the bench.py cases with 1, 2, 4, ... K threads and
+# reports the speedup and efficiency over one thread, the search
+# overhead (nodes compared to one thread), the nodes searched in
+# subtrees that were aborted after a cutoff in another thread, and the
+# time spent waiting for a free thread, as a table and a CSV file.
+# Build the binaries first with make bench.
+
+import argparse
+import csv
+import os
+
+from bench import CASES, case_name, run_case
+
+# pawnsonly --threads takes at most MAX_THREAD_SLOTS-1 (ThreadSlot.hpp)
+MAX_THREADS = 63
+
+def thread_counts(max_threads):
+    counts = []
+    k = 1
+    while k < max_threads:
+        counts.append(k)
+        k *= 2
+    return counts + [max_threads]
+
+def main():
+    parser = argparse.ArgumentParser(description="Measure how the solver scales with threads.")
+    parser.add_argument("--bin-dir", default="bench-build")
+    parser.add_argument("--case", default="7x7 7/pppppp1/7/7/PPPPPP1 w -",
+                        help="the first bench.py case whose name contains this")
+    parser.add_argument("--max-threads", type=int, default=min(2*(os.cpu_count() or 1), MAX_THREADS),
+                        help="at most %d" % MAX_THREADS)
+    parser.add_argument("--repeat", type=int, default=3,
+                        help="runs per thread count; the one with the median time is kept")
+    parser.add_argument("--csv", default="scaling.csv")
+    args = parser.parse_args()
+    args.max_threads = max(1, min(args.max_threads, MAX_THREADS))
+
+    n, position = next((n, pos) for n, pos in CASES if args.case in case_name(n, pos))
+    print("%s, up to %d threads" % (case_name(n, position), args.max_threads))
+    print()
+    print("%7s %9s %7s %10s %11s %8s %12s %9s" %
+          ("threads", "seconds", "speedup", "efficiency", "nodes", "overhead", "aborted", "waiting"))
+
+    rows = []
+    for k in thread_counts(args.max_threads):
+        runs = sorted((run_case(args.bin_dir, n, position, ["--threads", str(k)])
+                       for i in range(args.repeat)), key=lambda r: r["seconds"])
+        r = runs[len(runs)//2]
+        if not rows:
+            base = r
+        row = {
+            "threads": k,
+            "seconds": r["seconds"],
+            "speedup": base["seconds"]/r["seconds"],
+            "efficiency": base["seconds"]/r["seconds"]/k,
+            "nodes": r["nodes"],
+            "overhead": r["nodes"]/base["nodes"] - 1,
+            "aborted_nodes": r["aborted_nodes"],
+            "wait_seconds": r["wait_seconds"],
+        }
+        rows.append(row)
+        print("%7d %9.3f %7.2f %9.1f%% %11d %+7.1f%% %12d %8.3fs" %
+              (k, row["seconds"], row["speedup"], row["efficiency"]*100, row["nodes"],
+               row["overhead"]*100, row["aborted_nodes"], row["wait_seconds"]))
+
+    with open(args.csv, "w") as f:
+        w = csv.DictWriter(f, fieldnames=list(rows[0].keys()))
+        w.writeheader()
+        w.writerows(rows)
+    print()
+    print("Wrote %s" % args.csv)
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,381 @@
+// Copyright (C) 2016  Sami Liedes
+//
+// This program is free software; you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation; either version 2 of the License, or
+// (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License along
+// with this program; if not, write to the Free Software Foundation, Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+
+// Tablebase generator. Captures only ever reduce material, so the
+// classes are solved bottom-up by total number of pawns. A
+// non-capturing move from class (a, b) leads to class (b, a) after
+// canonize(), so all classes with the same total are solved together;
+// captures lead to the already solved classes with one pawn less.
+//
+// Within a total the solving is retrograde: every position counts its
+// distinct children in the same total, and positions whose result is
+// known are propagated to their predecessors (from Pos::get_unmoves())
+// in waves. A predecessor is a win as soon as one child is a loss, and
+// a draw or a loss when its last child has been resolved. Positions
+// are identified by their key tight_index.base(nw, nb) + index.
+
+#include "ClassEnumerator.hpp"
+#include "Pos.hpp"
+#include "Tablebase.hpp"
+#include "TightIndex.hpp"
+#include "TranspositionTable.hpp"
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <getopt.h>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using std::array;
+using std::atomic;
+using std::cerr;
+using std::cout;
+using std::endl;
+using std::string;
+using std::thread;
+using std::vector;
+
+// Values during generation are TpResults, plus this for positions
+// whose result is not known yet.
+static constexpr uint8_t UNKNOWN = 7;
+
+typedef vector<atomic<uint8_t>> ClassTable;
+
+// Pending counts: the number of unresolved children of each position,
+// with this bit set if one of the resolved children was a draw.
+static constexpr uint8_t DRAW_SEEN = 0x80;
+
+static int num_threads = std::thread::hardware_concurrency();
+
+// positions per compressed block; 16 KiB of packed results
+static constexpr uint64_t COMPRESS_BLOCK_SIZE = 65536;
+
+// Calls f(begin, end) on num_threads contiguous parts of [0, n).
+template<class F>
+static void parallel_for(uint64_t n, F f) {
+    vector<thread> threads;
+    for (int i=0; i<num_threads; i++) {
+	uint64_t begin = n*i/num_threads, end = n*(i+1)/num_threads;
+	threads.emplace_back([f, begin, end] { f(begin, end); });
+    }
+    for (auto &t : threads)
+	t.join();
+}
+
+class Generator {
+    const uint64_t block_size;
+    std::map<std::pair<int, int>, std::unique_ptr<ClassTable>> tables, pending;
+
+    static std::pair<int, int> class_of(uint64_t key) {
+	const int idx = tight_index.find(key);
+	return std::make_pair(idx/(N+1), idx%(N+1));
+    }
+
+    static uint64_t key_of(const Pos &p) {
+	return tight_index.base(p.get_num_white(), p.get_num_black()) + tight_index.index(p);
+    }
+
+    static Pos position_of(uint64_t key) {
+	const auto c = class_of(key);
+	return tight_index.position(c.first, c.second, key - tight_index.base(c.first, c.second));
+    }
+
+    atomic<uint8_t> &entry(std::map<std::pair<int, int>, std::unique_ptr<ClassTable>> &m,
+			   uint64_t key) {
+	const auto c = class_of(key);
+	return (*m.at(c))[key - tight_index.base(c.first, c.second)];
+    }
+
+    // result of a canonized position, from the point of view of white
+    uint8_t lookup(const Pos &p) const {
+	const int nw = p.get_num_white(), nb = p.get_num_black();
+	if (nw == 0)
+	    return uint8_t(TpResult::CURRENT_LOSS);
+	if (nb == 0)
+	    return uint8_t(TpResult::CURRENT_WIN);
+	const ClassTable &tab = *tables.at(std::make_pair(nw, nb));
+	return tab[tight_index.index(p)].load(std::memory_order_relaxed);
+    }
+
+    // p must have white to move. Returns the result if it follows from the
+    // captures alone, otherwise UNKNOWN; sets the pending count.
+    uint8_t evaluate(Pos &p, uint8_t &pend) const {
+	array<Pos::Move, MAX_LEGAL_MOVES> moves;
+	const int num_moves = p.get_legal_moves(moves);
+	const int total = p.get_num_white() + p.get_num_black();
+	pend = 0;
+
+	if (num_moves == 0) {
+	    const int w = p.winner();
+	    if (w == 1)
+		return uint8_t(TpResult::CURRENT_WIN);
+	    else if (w == -1)
+		return uint8_t(TpResult::CURRENT_LOSS);
+	    return uint8_t(TpResult::DRAW);
+	}
+
+	array<uint64_t, MAX_LEGAL_MOVES> children;
+	int num_children = 0;
+	bool draw = false;
+	for (int i=0; i<num_moves; i++) {
+	    p.do_move(moves[i]);
+	    Pos child(p);
+	    p.undo_move(moves[i]);
+	    child.canonize();
+	    if (child.get_num_white() + child.get_num_black() == total) {
+		// symmetric moves can lead to the same child; count it once
+		const uint64_t key = key_of(child);
+		if (std::find(&children[0], &children[num_children], key) ==
+		    &children[num_children])
+		    children[num_children++] = key;
+		continue;
+	    }
+	    const uint8_t v = lookup(child);
+	    if (v == uint8_t(TpResult::CURRENT_LOSS))
+		return uint8_t(TpResult::CURRENT_WIN);
+	    else if (v == uint8_t(TpResult::DRAW))
+		draw = true;
+	}
+	pend = num_children | (draw ? DRAW_SEEN : 0);
+	if (num_children > 0)
+	    return UNKNOWN;
+	return uint8_t(draw ? TpResult::DRAW : TpResult::CURRENT_LOSS);
+    }
+
+    // The keys of the distinct positions from which a non-capturing
+    // move leads to p. Returns count.
+    static int get_predecessors(const Pos &p, array<uint64_t, MAX_UNMOVES> &preds) {
+	array<Pos::Move, MAX_UNMOVES> unmoves;
+	const int num_unmoves = p.get_unmoves(unmoves);
+	int num_preds = 0;
+	for (int i=0; i<num_unmoves; i++) {
+	    if (unmoves[i].replacing || unmoves[i].ep_square != -1)
+		continue;
+	    Pos prev(p);
+	    prev.undo_move(unmoves[i]);
+	    prev.canonize();
+	    const uint64_t key = key_of(prev);
+	    if (std::find(&preds[0], &preds[num_preds], key) == &preds[num_preds])
+		preds[num_preds++] = key;
+	}
+	return num_preds;
+    }
+
+    // Evaluates the positions of a class; the indices not used stay
+    // NONE. Returns the number of positions; the resolved ones are
+    // added to resolved.
+    uint64_t init_class(int nw, int nb, vector<uint64_t> &resolved) {
+	const auto c = std::make_pair(nw, nb);
+	ClassTable &tab = *tables[c], &pend = *pending[c];
+	const uint64_t base = tight_index.base(nw, nb);
+	atomic<uint64_t> count{0};
+	std::mutex resolved_mutex;
+	parallel_for(ranks_tab.size(nw, nb), [&](uint64_t begin, uint64_t end) {
+		uint64_t n = 0;
+		vector<uint64_t> local;
+		for (ClassEnumerator e(nw, nb, begin, end); !e.done(); e.next()) {
+		    if (!e.is_valid() || !e.pos().is_canonical())
+			continue;
+		    Pos p(e.pos());
+		    const uint64_t i = tight_index.index(p);
+		    uint8_t pend_count;
+		    const uint8_t v = evaluate(p, pend_count);
+		    // a symmetric board with en passant on either side is
+		    // canonical both ways, but has one index
+		    if (tab[i].exchange(v, std::memory_order_relaxed) != uint8_t(TpResult::NONE))
+			continue;
+		    pend[i].store(pend_count, std::memory_order_relaxed);
+		    if (v != UNKNOWN)
+			local.push_back(base + i);
+		    n++;
+		}
+		count += n;
+		std::lock_guard<std::mutex> guard(resolved_mutex);
+		resolved.insert(resolved.end(), local.begin(), local.end());
+	    });
+	return count;
+    }
+
+    // Propagates the results of frontier to their predecessors.
+    // Returns the predecessors resolved by that.
+    vector<uint64_t> propagate(const vector<uint64_t> &frontier) {
+	vector<uint64_t> resolved;
+	std::mutex resolved_mutex;
+	parallel_for(frontier.size(), [&](uint64_t begin, uint64_t end) {
+		vector<uint64_t> local;
+		array<uint64_t, MAX_UNMOVES> preds;
+		for (uint64_t i=begin; i<end; i++) {
+		    const Pos p = position_of(frontier[i]);
+		    const uint8_t v = entry(tables, frontier[i]).load(std::memory_order_relaxed);
+		    const int num_preds = get_predecessors(p, preds);
+		    for (int j=0; j<num_preds; j++) {
+			atomic<uint8_t> &pv = entry(tables, preds[j]);
+			uint8_t result;
+			if (v == uint8_t(TpResult::CURRENT_LOSS))
+			    result = uint8_t(TpResult::CURRENT_WIN);
+			else {
+			    atomic<uint8_t> &pend = entry(pending, preds[j]);
+			    if (v == uint8_t(TpResult::DRAW))
+				pend.fetch_or(DRAW_SEEN, std::memory_order_relaxed);
+			    const uint8_t old = pend.fetch_sub(1, std::memory_order_relaxed);
+			    if ((old & ~DRAW_SEEN) != 1)
+				continue;
+			    result = uint8_t(old & DRAW_SEEN ? TpResult::DRAW :
+					     TpResult::CURRENT_LOSS);
+			}
+			// may already have been won through another child
+			uint8_t expected = UNKNOWN;
+			if (pv.compare_exchange_strong(expected, result, std::memory_order_relaxed))
+			    local.push_back(preds[j]);
+		    }
+		}
+		std::lock_guard<std::mutex> guard(resolved_mutex);
+		resolved.insert(resolved.end(), local.begin(), local.end());
+	    });
+	return resolved;
+    }
+
+    void write_class(const string &dir, int nw, int nb, const ClassTable &tab) const {
+	vector<uint8_t> packed((tab.size()+3)/4);
+	for (size_t i=0; i<tab.size(); i++)
+	    set_packed_result(packed.data(), i, TpResult(tab[i].load(std::memory_order_relaxed)));
+	write_tablebase(tablebase_filename(dir, nw, nb), nw, nb, packed.data(), block_size);
+    }
+
+public:
+    // block_size = 0 writes uncompressed tablebases
+    Generator(uint64_t block_size) : block_size(block_size) {}
+
+    // Solves all classes with total pawns (both sides having at least
+    // one); the classes with total-1 pawns must have been solved.
+    void solve_total(int total, const string &dir) {
+	vector<std::pair<int, int>> classes;
+	for (int nw=std::max(1, total-N); nw<=std::min(N, total-1); nw++)
+	    classes.emplace_back(nw, total-nw);
+
+	uint64_t unknown = 0;
+	vector<uint64_t> frontier;
+	for (auto c : classes) {
+	    const uint64_t size = tight_index.size(c.first, c.second);
+	    tables[c].reset(new ClassTable(size));
+	    pending[c].reset(new ClassTable(size));
+	}
+	for (auto c : classes) {
+	    const size_t num_resolved = frontier.size();
+	    uint64_t n = init_class(c.first, c.second, frontier);
+	    cout << "[" << time(NULL) << "] class " << c.first << "+" << c.second << ": "
+		 << tight_index.size(c.first, c.second) << " indices, " << n
+		 << " positions, " << frontier.size() - num_resolved
+		 << " resolved by captures" << endl;
+	    unknown += n;
+	}
+
+	unknown -= frontier.size();
+	for (int wave=1; !frontier.empty(); wave++) {
+	    frontier = propagate(frontier);
+	    unknown -= frontier.size();
+	    if (wave%10 == 0 || frontier.empty())
+		cout << "[" << time(NULL) << "] total " << total << ", wave " << wave << ": "
+		     << frontier.size() << " resolved, " << unknown << " left" << endl;
+	}
+	if (unknown > 0) {
+	    // the game graph has no cycles, so this should not happen
+	    cerr << unknown << " positions could not be resolved" << endl;
+	    abort();
+	}
+	for (auto c : classes)
+	    pending.erase(c);
+
+	for (auto c : classes) {
+	    array<uint64_t, 4> counts{{0}};
+	    for (const auto &v : *tables[c])
+		counts[v.load(std::memory_order_relaxed)]++;
+	    cout << "class " << c.first << "+" << c.second << ": " << counts[3] << " wins, "
+		 << counts[2] << " draws, " << counts[1] << " losses" << endl;
+	    write_class(dir, c.first, c.second, *tables[c]);
+	}
+
+	// only the classes just solved are needed for the next total
+	for (auto it = tables.begin(); it != tables.end(); )
+	    if (it->first.first + it->first.second < total)
+		it = tables.erase(it);
+	    else
+		++it;
+    }
+};
+
+static void usage(const char *argv0) {
+    cerr << "Usage: " << argv0 << " [options] MAX_PAWNS\n"
+	 << "Solves all material classes with at most MAX_PAWNS pawns in total.\n"
+	 << "  -j, --threads N     number of threads (default: number of CPUs)\n"
+	 << "  -o, --output DIR    directory for the tablebase files (default: .)\n"
+	 << "  -z, --compress      write block-compressed tablebases\n";
+}
+
+int main(int argc, char **argv) {
+    static const struct option long_options[] = {
+	{"threads", required_argument, nullptr, 'j'},
+	{"output", required_argument, nullptr, 'o'},
+	{"compress", no_argument, nullptr, 'z'},
+	{"help", no_argument, nullptr, 'h'},
+	{nullptr, 0, nullptr, 0}
+    };
+    string dir = ".";
+    bool compress = false;
+    int opt;
+    while ((opt = getopt_long(argc, argv, "j:o:zh", long_options, nullptr)) != -1) {
+	switch (opt) {
+	case 'j':
+	    num_threads = atoi(optarg);
+	    break;
+	case 'o':
+	    dir = optarg;
+	    break;
+	case 'z':
+	    compress = true;
+	    break;
+	case 'h':
+	    usage(argv[0]);
+	    return 0;
+	default:
+	    usage(argv[0]);
+	    return 1;
+	}
+    }
+    if (optind != argc-1 || num_threads < 1) {
+	usage(argv[0]);
+	return 1;
+    }
+    const int max_pawns = atoi(argv[optind]);
+    if (max_pawns < 2 || max_pawns > 2*N) {
+	cerr << "MAX_PAWNS must be between 2 and " << 2*N << endl;
+	return 1;
+    }
+
+    Generator gen(compress ? COMPRESS_BLOCK_SIZE : 0);
+    for (int total=2; total<=max_pawns; total++)
+	gen.solve_total(total, dir);
+}